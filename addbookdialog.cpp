@@ -71,23 +71,20 @@ void AddBookDialog::setupUI()
 
 void AddBookDialog::loadComboBoxes()
 {
-    // Загрузка авторов
-    QMap<int, QString> authors = m_db->getAuthorsMap();
-    for (auto it = authors.begin(); it != authors.end(); ++it) {
-        m_authorCombo->addItem(it.value(), it.key());
-    }
-    
-    // Загрузка жанров
-    QMap<int, QString> genres = m_db->getGenresMap();
-    for (auto it = genres.begin(); it != genres.end(); ++it) {
-        m_genreCombo->addItem(it.value(), it.key());
-    }
-    
-    // Загрузка издательств
-    QMap<int, QString> publishers = m_db->getPublishersMap();
-    for (auto it = publishers.begin(); it != publishers.end(); ++it) {
-        m_publisherCombo->addItem(it.value(), it.key());
-    }
+    // Списки заполняются, когда придут данные: при обрыве связи это произойдёт
+    // после переподключения
+    auto fill = [](QComboBox *combo) {
+        return [combo](const QMap<int, QString> &items) {
+            combo->clear();
+            for (auto it = items.begin(); it != items.end(); ++it) {
+                combo->addItem(it.value(), it.key());
+            }
+        };
+    };
+    
+    m_db->requestAuthorsMap(this, fill(m_authorCombo));
+    m_db->requestGenresMap(this, fill(m_genreCombo));
+    m_db->requestPublishersMap(this, fill(m_publisherCombo));
 }
 
 void AddBookDialog::accept()
@@ -110,6 +107,11 @@ void AddBookDialog::accept()
         return;
     }
     
+    if (m_authorCombo->count() == 0 || m_genreCombo->count() == 0 || m_publisherCombo->count() == 0) {
+        QMessageBox::warning(this, "Ошибка", "Справочники ещё не загружены, повторите после восстановления соединения");
+        return;
+    }
+    
     QString title = m_titleEdit->text().trimmed();
     int authorId = m_authorCombo->currentData().toInt();
     int genreId = m_genreCombo->currentData().toInt();
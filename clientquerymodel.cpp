@@ -0,0 +1,672 @@
+#include "clientquerymodel.h"
+#include "sqlbackend.h"
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QSqlField>
+#include <QSqlQueryModel>
+#include <QSqlRecord>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CLIENTQUERY_SSE2
+#endif
+
+namespace {
+
+const int MaxSortKeys = 3;
+// Меньшие куски не окупают передачу в пул потоков
+const int MinChunkRows = 16384;
+
+int fieldTypeId(const QSqlField &field)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    return field.metaType().id();
+#else
+    return int(field.type());
+#endif
+}
+
+bool isNumericType(int typeId)
+{
+    switch (typeId) {
+    case QMetaType::Bool:
+    case QMetaType::Short:
+    case QMetaType::UShort:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::Long:
+    case QMetaType::ULong:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+    case QMetaType::Float:
+    case QMetaType::Double:
+    case QMetaType::QDate:
+    case QMetaType::QTime:
+    case QMetaType::QDateTime:
+        return true;
+    default:
+        return false;
+    }
+}
+
+double numberOf(const QVariant &value)
+{
+    switch (value.userType()) {
+    case QMetaType::QDate:
+        return double(value.toDate().toJulianDay());
+    case QMetaType::QTime:
+        return double(value.toTime().msecsSinceStartOfDay());
+    case QMetaType::QDateTime:
+        return double(value.toDateTime().toMSecsSinceEpoch());
+    default:
+        return value.toDouble();
+    }
+}
+
+const ushort *units(const QString &text)
+{
+    return reinterpret_cast<const ushort *>(text.utf16());
+}
+
+bool isWordUnit(ushort unit)
+{
+    return QChar(unit).isLetterOrNumber();
+}
+
+// Совпадение засчитывается только в начале слова: в начале строки или
+// после символа, который не буква и не цифра
+bool startsWordAt(const ushort *text, int pos, const ushort *needle, int needleLength)
+{
+    return (pos == 0 || !isWordUnit(text[pos - 1]))
+        && std::memcmp(text + pos, needle, size_t(needleLength) * sizeof(ushort)) == 0;
+}
+
+bool containsWordStart(const ushort *text, int length, const ushort *needle, int needleLength)
+{
+    if (needleLength == 0) return true;
+    if (needleLength > length) return false;
+
+    int i = 0;
+#ifdef CLIENTQUERY_SSE2
+    // Сравниваем первый и последний символ образца сразу в восьми позициях,
+    // полное сравнение только там, где совпали оба
+    const __m128i first = _mm_set1_epi16(short(needle[0]));
+    const __m128i last = _mm_set1_epi16(short(needle[needleLength - 1]));
+    for (; i + needleLength + 7 <= length; i += 8) {
+        const __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+        const __m128i blockLast = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i + needleLength - 1));
+        uint mask = uint(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(first, blockFirst),
+                                                         _mm_cmpeq_epi16(last, blockLast))));
+        while (mask) {
+            const int bit = qCountTrailingZeroBits(mask);
+            if (startsWordAt(text, i + bit / 2, needle, needleLength)) {
+                return true;
+            }
+            mask &= ~(3u << bit);
+        }
+    }
+#endif
+    for (; i + needleLength <= length; ++i) {
+        if (text[i] == needle[0] && startsWordAt(text, i, needle, needleLength)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int compareText(const ushort *a, int aLength, const ushort *b, int bLength)
+{
+    const int length = qMin(aLength, bLength);
+    for (int i = 0; i < length; ++i) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return aLength < bLength ? -1 : (aLength > bLength ? 1 : 0);
+}
+
+int chunkCount(int rows)
+{
+    return qBound(1, rows / MinChunkRows, qMax(1, QThreadPool::globalInstance()->maxThreadCount()));
+}
+
+QModelIndex sourceIndex(const QModelIndex &index)
+{
+    const QAbstractProxyModel *proxy = qobject_cast<const QAbstractProxyModel *>(index.model());
+    return proxy ? proxy->mapToSource(index) : index;
+}
+
+} // namespace
+
+ClientQueryModel::ClientQueryModel(QObject *parent)
+    : QAbstractProxyModel(parent)
+    , m_queryModel(nullptr)
+    , m_sourceRows(0)
+    , m_loading(false)
+    , m_lastQueryMs(0)
+{
+}
+
+void ClientQueryModel::setSourceModel(QAbstractItemModel *source)
+{
+    if (sourceModel()) {
+        disconnect(sourceModel(), nullptr, this, nullptr);
+    }
+    QAbstractProxyModel::setSourceModel(source);
+
+    m_queryModel = qobject_cast<QSqlQueryModel *>(source);
+    m_sortKeys.clear();
+    m_words.clear();
+    m_filterColumns.clear();
+
+    if (source) {
+        connect(source, &QAbstractItemModel::modelReset, this, &ClientQueryModel::reload);
+        connect(source, &QAbstractItemModel::layoutChanged, this, &ClientQueryModel::reload);
+        connect(source, &QAbstractItemModel::rowsInserted, this, &ClientQueryModel::onSourceRowsInserted);
+        connect(source, &QAbstractItemModel::rowsRemoved, this, &ClientQueryModel::reload);
+        connect(source, &QAbstractItemModel::dataChanged, this, &ClientQueryModel::onSourceDataChanged);
+        connect(source, &QAbstractItemModel::headerDataChanged, this, &QAbstractItemModel::headerDataChanged);
+        connect(source, &QObject::destroyed, this, [this]() {
+            m_queryModel = nullptr;
+            beginResetModel();
+            clearCache();
+            endResetModel();
+        });
+    }
+    reload();
+}
+
+QModelIndex ClientQueryModel::index(int row, int column, const QModelIndex &parent) const
+{
+    if (parent.isValid() || row < 0 || row >= m_rows.size() || column < 0 || column >= m_columns.size()) {
+        return QModelIndex();
+    }
+    return createIndex(row, column);
+}
+
+QModelIndex ClientQueryModel::parent(const QModelIndex &) const
+{
+    return QModelIndex();
+}
+
+int ClientQueryModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_rows.size();
+}
+
+int ClientQueryModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_columns.size();
+}
+
+QModelIndex ClientQueryModel::mapToSource(const QModelIndex &proxyIndex) const
+{
+    if (!sourceModel() || !proxyIndex.isValid() || proxyIndex.row() >= m_rows.size()) {
+        return QModelIndex();
+    }
+    return sourceModel()->index(m_rows.at(proxyIndex.row()), proxyIndex.column());
+}
+
+QModelIndex ClientQueryModel::mapFromSource(const QModelIndex &sourceIndex) const
+{
+    if (!sourceIndex.isValid()) {
+        return QModelIndex();
+    }
+    const int row = m_sourceToProxy.value(sourceIndex.row(), -1);
+    return row < 0 ? QModelIndex() : index(row, sourceIndex.column());
+}
+
+QVariant ClientQueryModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    // Базовая реализация ищет столбец через строку 0, которой при пустом результате нет
+    if (orientation == Qt::Horizontal) {
+        return sourceModel() ? sourceModel()->headerData(section, orientation, role) : QVariant();
+    }
+    return role == Qt::DisplayRole ? QVariant(section + 1) : QVariant();
+}
+
+bool ClientQueryModel::canFetchMore(const QModelIndex &parent) const
+{
+    // С сортировкой или фильтром источник уже загружен целиком
+    return !parent.isValid() && !isActive() && sourceModel() && sourceModel()->canFetchMore(QModelIndex());
+}
+
+void ClientQueryModel::fetchMore(const QModelIndex &parent)
+{
+    // Новые строки придут через rowsInserted источника
+    if (canFetchMore(parent)) {
+        sourceModel()->fetchMore(QModelIndex());
+    }
+}
+
+void ClientQueryModel::sort(int column, Qt::SortOrder order)
+{
+    QVector<SortKey> keys = m_sortKeys;
+    if (column < 0) {
+        keys.clear();
+    } else {
+        keys.erase(std::remove_if(keys.begin(), keys.end(),
+                                  [column](const SortKey &key) { return key.column == column; }),
+                   keys.end());
+        keys.prepend({column, order});
+        if (keys.size() > MaxSortKeys) {
+            keys.resize(MaxSortKeys);
+        }
+    }
+    setSortKeys(keys);
+}
+
+void ClientQueryModel::setSortKeys(const QVector<SortKey> &keys)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    beginResetModel();
+    const bool wasActive = isActive();
+    m_sortKeys.clear();
+    for (const SortKey &key : keys) {
+        if (key.column >= 0 && key.column < m_columns.size()) {
+            m_sortKeys.append(key);
+        }
+    }
+    // Если строки уже отобраны по загруженному целиком источнику, достаточно
+    // переставить их; иначе запрос выполняется заново
+    if (wasActive && isActive() && !prepareCache()) {
+        if (m_sortKeys.isEmpty()) {
+            std::sort(m_rows.begin(), m_rows.end());
+        } else {
+            sortRows(m_rows);
+        }
+        updateReverseMap();
+    } else {
+        runQuery(false);
+    }
+    endResetModel();
+
+    m_lastQueryMs = timer.elapsed();
+}
+
+void ClientQueryModel::setFilterColumns(const QVector<int> &columns)
+{
+    if (columns == m_filterColumns) return;
+
+    m_filterColumns.clear();
+    for (int column : columns) {
+        if (column >= 0 && column < m_columns.size()) {
+            m_filterColumns.append(column);
+        }
+    }
+    if (!m_words.isEmpty()) {
+        beginResetModel();
+        runQuery(false);
+        endResetModel();
+    }
+}
+
+void ClientQueryModel::setTextFilter(const QStringList &words)
+{
+    QStringList folded;
+    for (const QString &word : words) {
+        folded << word.toCaseFolded();
+    }
+    if (folded == m_words) return;
+
+    // Уточнение запроса фильтрует только уже отобранные строки
+    const bool refine = isActive() && SqlBackend::isSearchRefinement(m_words, folded);
+    beginResetModel();
+    m_words = folded;
+    runQuery(refine);
+    endResetModel();
+}
+
+void ClientQueryModel::reload()
+{
+    if (m_loading) return;
+
+    // Кэш столбцов строится заново, только если заданы сортировка или фильтр;
+    // без них перечитывание источника обходится сменой счётчика строк
+    beginResetModel();
+    clearCache();
+    if (sourceModel()) {
+        m_sourceRows = sourceModel()->rowCount();
+        m_columns.resize(sourceModel()->columnCount());
+    }
+    runQuery(false);
+    endResetModel();
+}
+
+void ClientQueryModel::onSourceRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    if (m_loading || parent.isValid()) return;
+
+    // Догрузка в конец без сортировки и фильтра просто продолжает таблицу
+    if (isActive() || first != m_sourceRows) {
+        reload();
+        return;
+    }
+    beginInsertRows(QModelIndex(), first, last);
+    for (int row = first; row <= last; ++row) {
+        m_sourceToProxy.append(m_rows.size());
+        m_rows.append(row);
+    }
+    m_sourceRows = last + 1;
+    for (int c = 0; c < m_columns.size(); ++c) {
+        Column &column = m_columns[c];
+        if (!column.loaded) continue;
+        for (int row = first; row <= last; ++row) {
+            setCell(column, row, sourceModel()->index(row, c).data(), true);
+        }
+    }
+    endInsertRows();
+}
+
+void ClientQueryModel::onSourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    if (m_loading || !topLeft.isValid() || !bottomRight.isValid()) return;
+
+    // Правка обновляет кэш, но строки не переставляет, чтобы они не прыгали под курсором
+    const int lastRow = qMin(bottomRight.row(), m_sourceRows - 1);
+    const int lastColumn = qMin(bottomRight.column(), m_columns.size() - 1);
+    for (int row = topLeft.row(); row <= lastRow; ++row) {
+        for (int c = topLeft.column(); c <= lastColumn; ++c) {
+            if (m_columns.at(c).loaded) {
+                setCell(m_columns[c], row, sourceModel()->index(row, c).data(), false);
+            }
+        }
+        const int proxyRow = m_sourceToProxy.value(row, -1);
+        if (proxyRow >= 0) {
+            emit dataChanged(index(proxyRow, topLeft.column()), index(proxyRow, lastColumn));
+        }
+    }
+}
+
+bool ClientQueryModel::prepareCache()
+{
+    // Догружаем источник целиком и копируем только столбцы, нужные сортировке
+    // и фильтру. Возвращает true, если у источника появились новые строки
+    QAbstractItemModel *source = sourceModel();
+    if (!source) return false;
+
+    m_loading = true;
+    while (source->canFetchMore(QModelIndex())) {
+        source->fetchMore(QModelIndex());
+    }
+    m_loading = false;
+
+    const int rows = source->rowCount();
+    const bool grown = rows != m_sourceRows;
+    if (grown) {
+        for (int c = 0; c < m_columns.size(); ++c) {
+            Column &column = m_columns[c];
+            if (!column.loaded) continue;
+            for (int row = m_sourceRows; row < rows; ++row) {
+                setCell(column, row, source->index(row, c).data(), true);
+            }
+        }
+        m_sourceRows = rows;
+    }
+
+    QVector<int> needed;
+    for (const SortKey &key : m_sortKeys) {
+        needed << key.column;
+    }
+    if (!m_words.isEmpty()) {
+        needed << m_filterColumns;
+    }
+    for (int column : needed) {
+        if (!m_columns.at(column).loaded) {
+            loadColumn(column);
+        }
+    }
+    return grown;
+}
+
+void ClientQueryModel::loadColumn(int c)
+{
+    // Через data(), а не record(): так видны и несохранённые правки, и
+    // подставленные значения связей QSqlRelationalTableModel
+    QAbstractItemModel *source = sourceModel();
+    Column &column = m_columns[c];
+    column = Column();
+    column.numeric = m_queryModel
+        ? isNumericType(fieldTypeId(m_queryModel->record().field(c)))
+        : m_sourceRows > 0 && isNumericType(source->index(0, c).data().userType());
+    column.nulls.reserve(m_sourceRows);
+    if (column.numeric) {
+        column.numbers.reserve(m_sourceRows);
+    } else {
+        column.starts.reserve(m_sourceRows);
+        column.lengths.reserve(m_sourceRows);
+    }
+    for (int row = 0; row < m_sourceRows; ++row) {
+        setCell(column, row, source->index(row, c).data(), true);
+    }
+    column.loaded = true;
+}
+
+void ClientQueryModel::setCell(Column &column, int row, const QVariant &value, bool append)
+{
+    const quint8 isNull = value.isNull() ? 1 : 0;
+    if (column.numeric) {
+        const double number = isNull ? 0.0 : numberOf(value);
+        if (append) {
+            column.nulls.append(isNull);
+            column.numbers.append(number);
+        } else {
+            column.nulls[row] = isNull;
+            column.numbers[row] = number;
+        }
+        return;
+    }
+
+    // Изменённый текст дописывается в конец буфера; место старого
+    // значения освобождается при следующей перезагрузке
+    const QString folded = isNull ? QString() : value.toString().toCaseFolded();
+    const int start = column.text.size();
+    column.text.resize(start + folded.size());
+    if (!folded.isEmpty()) {
+        std::memcpy(column.text.data() + start, folded.utf16(), size_t(folded.size()) * sizeof(ushort));
+    }
+    if (append) {
+        column.nulls.append(isNull);
+        column.starts.append(start);
+        column.lengths.append(folded.size());
+    } else {
+        column.nulls[row] = isNull;
+        column.starts[row] = start;
+        column.lengths[row] = folded.size();
+    }
+}
+
+void ClientQueryModel::clearCache()
+{
+    m_columns.clear();
+    m_rows.clear();
+    m_sourceToProxy.clear();
+    m_sourceRows = 0;
+}
+
+bool ClientQueryModel::matches(int row) const
+{
+    for (const QString &word : m_words) {
+        bool found = false;
+        for (int c : m_filterColumns) {
+            const Column &column = m_columns.at(c);
+            if (column.numeric) continue;
+            found = containsWordStart(column.text.constData() + column.starts.at(row), column.lengths.at(row),
+                                      units(word), word.size());
+            if (found) break;
+        }
+        if (!found) return false;
+    }
+    return true;
+}
+
+int ClientQueryModel::compareRows(int a, int b) const
+{
+    for (const SortKey &key : m_sortKeys) {
+        const Column &column = m_columns.at(key.column);
+        int result;
+        if (column.nulls.at(a) || column.nulls.at(b)) {
+            // NULL считается меньше любого значения
+            result = int(column.nulls.at(b)) - int(column.nulls.at(a));
+        } else if (column.numeric) {
+            const double x = column.numbers.at(a);
+            const double y = column.numbers.at(b);
+            result = x < y ? -1 : (x > y ? 1 : 0);
+        } else {
+            result = compareText(column.text.constData() + column.starts.at(a), column.lengths.at(a),
+                                 column.text.constData() + column.starts.at(b), column.lengths.at(b));
+        }
+        if (result != 0) {
+            return key.order == Qt::AscendingOrder ? result : -result;
+        }
+    }
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+QVector<int> ClientQueryModel::filterRows(const QVector<int> &candidates) const
+{
+    // Куски фильтруются параллельно и склеиваются по порядку, поэтому
+    // порядок сортировки кандидатов сохраняется
+    const int chunks = chunkCount(candidates.size());
+    const int *data = candidates.constData();
+    auto filterChunk = [this, data](int begin, int end) {
+        QVector<int> rows;
+        for (int i = begin; i < end; ++i) {
+            if (matches(data[i])) {
+                rows.append(data[i]);
+            }
+        }
+        return rows;
+    };
+
+    if (chunks == 1) {
+        return filterChunk(0, candidates.size());
+    }
+
+    QVector<QFuture<QVector<int>>> futures;
+    for (int c = 0; c < chunks; ++c) {
+        const int begin = int(qint64(candidates.size()) * c / chunks);
+        const int end = int(qint64(candidates.size()) * (c + 1) / chunks);
+        futures.append(QtConcurrent::run([filterChunk, begin, end]() { return filterChunk(begin, end); }));
+    }
+    QVector<int> rows;
+    for (QFuture<QVector<int>> &future : futures) {
+        rows += future.result();
+    }
+    return rows;
+}
+
+void ClientQueryModel::sortRows(QVector<int> &rows) const
+{
+    auto less = [this](int a, int b) { return compareRows(a, b) < 0; };
+    const int count = rows.size();
+    const int chunks = chunkCount(count);
+    int *data = rows.data();
+
+    if (chunks == 1) {
+        std::sort(data, data + count, less);
+        return;
+    }
+
+    // Куски сортируются в пуле потоков, затем сливаются попарно; слияния
+    // одного прохода тоже независимы и идут параллельно
+    QVector<int> bounds;
+    for (int c = 0; c <= chunks; ++c) {
+        bounds.append(int(qint64(count) * c / chunks));
+    }
+
+    QVector<QFuture<void>> futures;
+    for (int c = 0; c < chunks; ++c) {
+        int *begin = data + bounds.at(c);
+        int *end = data + bounds.at(c + 1);
+        futures.append(QtConcurrent::run([begin, end, less]() { std::sort(begin, end, less); }));
+    }
+    for (QFuture<void> &future : futures) {
+        future.waitForFinished();
+    }
+
+    QVector<int> buffer(count);
+    int *from = data;
+    int *to = buffer.data();
+    while (bounds.size() > 2) {
+        QVector<int> next;
+        futures.clear();
+        for (int i = 0; i + 1 < bounds.size(); i += 2) {
+            const int low = bounds.at(i);
+            const int middle = bounds.at(i + 1);
+            const int high = i + 2 < bounds.size() ? bounds.at(i + 2) : middle;
+            futures.append(QtConcurrent::run([from, to, low, middle, high, less]() {
+                std::merge(from + low, from + middle, from + middle, from + high, to + low, less);
+            }));
+            next.append(low);
+        }
+        next.append(count);
+        for (QFuture<void> &future : futures) {
+            future.waitForFinished();
+        }
+        std::swap(from, to);
+        bounds = next;
+    }
+    if (from != data) {
+        std::copy(from, from + count, data);
+    }
+}
+
+void ClientQueryModel::runQuery(bool refine)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const bool grown = isActive() && prepareCache();
+    if (refine && !grown) {
+        if (!m_words.isEmpty()) {
+            m_rows = filterRows(m_rows);
+        }
+    } else {
+        QVector<int> rows(m_sourceRows);
+        std::iota(rows.begin(), rows.end(), 0);
+        m_rows = m_words.isEmpty() ? rows : filterRows(rows);
+        if (!m_sortKeys.isEmpty()) {
+            sortRows(m_rows);
+        }
+    }
+    updateReverseMap();
+
+    m_lastQueryMs = timer.elapsed();
+}
+
+void ClientQueryModel::updateReverseMap()
+{
+    m_sourceToProxy.fill(-1, m_sourceRows);
+    for (int i = 0; i < m_rows.size(); ++i) {
+        m_sourceToProxy[m_rows.at(i)] = i;
+    }
+}
+
+QWidget *ProxyRelationalDelegate::createEditor(QWidget *parent, const QStyleOptionViewItem &option,
+                                               const QModelIndex &index) const
+{
+    return QSqlRelationalDelegate::createEditor(parent, option, sourceIndex(index));
+}
+
+void ProxyRelationalDelegate::setEditorData(QWidget *editor, const QModelIndex &index) const
+{
+    QSqlRelationalDelegate::setEditorData(editor, sourceIndex(index));
+}
+
+void ProxyRelationalDelegate::setModelData(QWidget *editor, QAbstractItemModel *model, const QModelIndex &index) const
+{
+    QAbstractProxyModel *proxy = qobject_cast<QAbstractProxyModel *>(model);
+    if (proxy) {
+        QSqlRelationalDelegate::setModelData(editor, proxy->sourceModel(), proxy->mapToSource(index));
+    } else {
+        QSqlRelationalDelegate::setModelData(editor, model, index);
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef CLIENTQUERYMODEL_H
+#define CLIENTQUERYMODEL_H
+
+#include <QAbstractProxyModel>
+#include <QSqlRelationalDelegate>
+#include <QStringList>
+#include <QVector>
+
+class QSqlQueryModel;
+
+// Сортировка и фильтрация уже загруженных строк без обращения к серверу.
+// Пока сортировка и фильтр не заданы, модель прозрачна и догружает строки
+// источника по мере прокрутки. Иначе нужные столбцы копируются в плотные
+// массивы (числа отдельно, текст в свёрнутом регистре одним буфером),
+// сортировка — параллельное слияние, поиск слов — SSE2 по буферу текста.
+class ClientQueryModel : public QAbstractProxyModel
+{
+    Q_OBJECT
+
+public:
+    struct SortKey {
+        int column;
+        Qt::SortOrder order;
+    };
+
+    explicit ClientQueryModel(QObject *parent = nullptr);
+
+    void setSourceModel(QAbstractItemModel *sourceModel) override;
+
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &child) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex mapToSource(const QModelIndex &proxyIndex) const override;
+    QModelIndex mapFromSource(const QModelIndex &sourceIndex) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+
+    // Щелчок по заголовку делает столбец первым ключом, прежние ключи сдвигаются
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+    void setSortKeys(const QVector<SortKey> &keys);
+
+    // Строка таблицы подходит, если каждое слово — начало какого-то слова
+    // хотя бы в одном из столбцов фильтра (как SqlBackend::searchFilter())
+    void setFilterColumns(const QVector<int> &columns);
+    void setTextFilter(const QStringList &words);
+
+    qint64 lastQueryMs() const { return m_lastQueryMs; }
+
+private slots:
+    void reload();
+    void onSourceRowsInserted(const QModelIndex &parent, int first, int last);
+    void onSourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+
+private:
+    struct Column {
+        bool loaded = false;
+        bool numeric = false;
+        QVector<double> numbers;
+        QVector<ushort> text;   // свёрнутый регистр, строки подряд
+        QVector<int> starts;
+        QVector<int> lengths;
+        QVector<quint8> nulls;
+    };
+
+    QSqlQueryModel *m_queryModel;
+    QVector<Column> m_columns;
+    int m_sourceRows;
+    QVector<int> m_rows;          // строка прокси -> строка источника
+    QVector<int> m_sourceToProxy;
+    QVector<SortKey> m_sortKeys;
+    QVector<int> m_filterColumns;
+    QStringList m_words;          // в свёрнутом регистре
+    bool m_loading;
+    qint64 m_lastQueryMs;
+
+    bool isActive() const { return !m_sortKeys.isEmpty() || !m_words.isEmpty(); }
+    bool prepareCache();
+    void loadColumn(int column);
+    void setCell(Column &column, int row, const QVariant &value, bool append);
+    void clearCache();
+    bool matches(int row) const;
+    int compareRows(int a, int b) const;
+    QVector<int> filterRows(const QVector<int> &candidates) const;
+    void sortRows(QVector<int> &rows) const;
+    void runQuery(bool refine);
+    void updateReverseMap();
+};
+
+// QSqlRelationalDelegate работает только с самой реляционной моделью,
+// поэтому индексы прокси переводятся в индексы источника
+class ProxyRelationalDelegate : public QSqlRelationalDelegate
+{
+    Q_OBJECT
+
+public:
+    using QSqlRelationalDelegate::QSqlRelationalDelegate;
+
+    QWidget *createEditor(QWidget *parent, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+    void setEditorData(QWidget *editor, const QModelIndex &index) const override;
+    void setModelData(QWidget *editor, QAbstractItemModel *model, const QModelIndex &index) const override;
+};
+
+#endif // CLIENTQUERYMODEL_H
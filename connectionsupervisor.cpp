@@ -0,0 +1,341 @@
+#include "connectionsupervisor.h"
+#include <QSqlError>
+#include <QDebug>
+
+namespace {
+
+const int HeartbeatIntervalMs = 10000;
+const int InitialBackoffMs = 250;
+const int MaxBackoffMs = 8000;
+const char *ProbeConnection = "practics_probe";
+
+} // namespace
+
+ConnectionProbe::ConnectionProbe(const QSqlDatabase &db)
+    : m_driver(db.driverName())
+    , m_database(db.databaseName())
+    , m_user(db.userName())
+    , m_password(db.password())
+    , m_host(db.hostName())
+    , m_options(db.connectOptions())
+    , m_port(db.port())
+{
+}
+
+void ConnectionProbe::probe()
+{
+    // Соединение создаётся в потоке проверки: QSqlDatabase нельзя
+    // использовать из другого потока, чем тот, где его открыли
+    QSqlDatabase db = QSqlDatabase::database(ProbeConnection, false);
+    if (!db.isValid()) {
+        db = QSqlDatabase::addDatabase(m_driver, ProbeConnection);
+        db.setDatabaseName(m_database);
+        db.setUserName(m_user);
+        db.setPassword(m_password);
+        db.setHostName(m_host);
+        db.setPort(m_port);
+        db.setConnectOptions(m_options);
+    }
+
+    bool reachable = db.isOpen() || db.open();
+    if (reachable) {
+        QSqlQuery query(db);
+        reachable = query.exec("SELECT 1");
+    }
+    if (!reachable) {
+        db.close();
+    }
+    emit probed(reachable);
+}
+
+void ConnectionProbe::shutdown()
+{
+    {
+        QSqlDatabase db = QSqlDatabase::database(ProbeConnection, false);
+        if (db.isValid()) {
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(ProbeConnection);
+}
+
+ConnectionSupervisor::ConnectionSupervisor(const QSqlDatabase &db, QObject *parent)
+    : QObject(parent)
+    , m_db(db)
+    , m_state(Connected)
+    , m_backoffMs(InitialBackoffMs)
+    , m_attempts(0)
+    , m_lastRecoveryMs(-1)
+    , m_probe(nullptr)
+    , m_probing(false)
+    , m_suspect(false)
+{
+    m_heartbeat.setInterval(HeartbeatIntervalMs);
+    connect(&m_heartbeat, &QTimer::timeout, this, &ConnectionSupervisor::checkConnection);
+
+    m_retryTimer.setSingleShot(true);
+    connect(&m_retryTimer, &QTimer::timeout, this, &ConnectionSupervisor::checkConnection);
+
+    m_expiryTimer.setSingleShot(true);
+    connect(&m_expiryTimer, &QTimer::timeout, this, &ConnectionSupervisor::expireQueue);
+}
+
+ConnectionSupervisor::~ConnectionSupervisor()
+{
+    if (m_probeThread.isRunning()) {
+        QMetaObject::invokeMethod(m_probe, "shutdown", Qt::BlockingQueuedConnection);
+        m_probeThread.quit();
+        m_probeThread.wait();
+    }
+    delete m_probe;
+    qDeleteAll(m_statements);
+}
+
+void ConnectionSupervisor::start()
+{
+    // Параметры подключения к этому моменту уже заданы
+    if (!m_probe) {
+        m_probe = new ConnectionProbe(m_db);
+        m_probe->moveToThread(&m_probeThread);
+        connect(m_probe, &ConnectionProbe::probed, this, &ConnectionSupervisor::onProbed);
+        m_probeThread.start();
+    }
+    m_state = Connected;
+    m_heartbeat.start();
+}
+
+QSqlQuery* ConnectionSupervisor::prepared(const QString &sql)
+{
+    auto it = m_statements.constFind(sql);
+    if (it != m_statements.constEnd()) {
+        return it.value();
+    }
+
+    QSqlQuery *query = new QSqlQuery(m_db);
+    query->setForwardOnly(true);
+    query->prepare(sql);
+    m_statements.insert(sql, query);
+    return query;
+}
+
+bool ConnectionSupervisor::run(const std::function<bool()> &request)
+{
+    if (m_state != Connected) {
+        return false;
+    }
+    if (request()) {
+        return true;
+    }
+    reportFailure();
+    return false;
+}
+
+void ConnectionSupervisor::enqueue(const std::function<bool()> &request, QObject *context, int deadlineMs)
+{
+    if (m_state == Connected) {
+        if (request()) {
+            return;
+        }
+        // Без проверки связи (встроенная база) повторять некому
+        if (!m_probeThread.isRunning()) {
+            return;
+        }
+        reportFailure();
+    }
+    Pending pending;
+    pending.context = context;
+    pending.request = request;
+    pending.deadline = QDeadlineTimer(deadlineMs);
+    m_queue.append(pending);
+    scheduleExpiry();
+}
+
+void ConnectionSupervisor::reportFailure()
+{
+    // Отличить ошибку в самом запросе от обрыва можно только запросом к
+    // серверу, поэтому ответ придёт позже в onProbed()
+    m_suspect = true;
+    checkConnection();
+}
+
+void ConnectionSupervisor::watchModel(QSqlTableModel *model)
+{
+    m_models.removeAll(QPointer<QSqlTableModel>());
+    m_models.append(model);
+}
+
+void ConnectionSupervisor::checkConnection()
+{
+    if (m_probing || !m_probeThread.isRunning()) {
+        return;
+    }
+    m_probing = true;
+    QMetaObject::invokeMethod(m_probe, "probe", Qt::QueuedConnection);
+}
+
+void ConnectionSupervisor::onProbed(bool reachable)
+{
+    m_probing = false;
+
+    if (m_state == Connected) {
+        if (!reachable) {
+            connectionLost();
+            return;
+        }
+        if (m_suspect) {
+            m_suspect = false;
+            // Сервер ответил соединению проверки, но сокет основного соединения
+            // мог оборваться молча, и запрос по нему завис бы в потоке окна до
+            // tcp_user_timeout. Поэтому основное соединение не проверяем, а
+            // открываем заново: при доступном сервере это быстро
+            if (!reopen()) {
+                connectionLost();
+                return;
+            }
+            runQueue();
+        }
+        return;
+    }
+
+    m_attempts++;
+    if (!reachable || !reopen()) {
+        qDebug() << "Попытка переподключения" << m_attempts << "не удалась:" << m_db.lastError().text();
+        m_backoffMs = qMin(m_backoffMs * 2, MaxBackoffMs);
+        m_retryTimer.start(m_backoffMs);
+        return;
+    }
+
+    m_lastRecoveryMs = m_outage.elapsed();
+    qDebug() << "Соединение восстановлено за" << m_lastRecoveryMs << "мс, попыток:" << m_attempts;
+
+    m_state = Connected;
+    m_suspect = false;
+    m_heartbeat.start();
+    emit stateChanged(m_state);
+    emit reconnected(m_lastRecoveryMs);
+    runQueue();
+}
+
+bool ConnectionSupervisor::probeSession()
+{
+    if (!m_db.isOpen()) {
+        return false;
+    }
+    QSqlQuery query(m_db);
+    return query.exec("SELECT 1");
+}
+
+void ConnectionSupervisor::connectionLost()
+{
+    if (m_state == Reconnecting) {
+        return;
+    }
+
+    qDebug() << "Соединение с базой данных потеряно";
+    m_state = Reconnecting;
+    m_attempts = 0;
+    m_backoffMs = InitialBackoffMs;
+    m_outage.start();
+    m_heartbeat.stop();
+    m_retryTimer.start(0);
+    emit stateChanged(m_state);
+}
+
+bool ConnectionSupervisor::reopen()
+{
+    // Открываем основное соединение, только когда поток проверки уже достучался
+    // до сервера: тогда open() в потоке окна не ждёт connect_timeout, а запрос
+    // по свежему соединению не упирается в оборванный сокет
+    m_db.close();
+    if (!m_db.open() || !probeSession()) {
+        return false;
+    }
+    restoreSession();
+    return true;
+}
+
+void ConnectionSupervisor::restoreSession()
+{
+    // Подготовленные операторы живут в сеансе сервера, поэтому готовим их заново
+    for (auto it = m_statements.begin(); it != m_statements.end(); ++it) {
+        delete it.value();
+        QSqlQuery *query = new QSqlQuery(m_db);
+        query->setForwardOnly(true);
+        query->prepare(it.key());
+        it.value() = query;
+    }
+
+    // close() делает недействительными запросы моделей, поэтому модели
+    // перечитываются. Несохранённые правки досылаются (submitAll() после успеха
+    // сам перечитывает модель). Модель OnManualSubmit с правками не трогаем:
+    // select() сбросил бы их, а строки остаются читаемыми, только пока QPSQL
+    // держит полученный результат в памяти клиента
+    for (const QPointer<QSqlTableModel> &model : m_models) {
+        if (!model) continue;
+        if (!model->isDirty()) {
+            model->select();
+        } else if (model->editStrategy() != QSqlTableModel::OnManualSubmit) {
+            if (!model->submitAll()) {
+                qDebug() << "Не удалось досохранить правки таблицы" << model->tableName()
+                         << model->lastError().text();
+            }
+        } else if (m_db.driverName() != "QPSQL") {
+            qDebug() << "Таблица" << model->tableName() << "перечитана, несохранённые правки потеряны";
+            model->select();
+        }
+    }
+}
+
+void ConnectionSupervisor::runQueue()
+{
+    // Каждый отложенный запрос выполняется один раз: при новой ошибке он
+    // отбрасывается, чтобы не зациклиться на запросе с ошибкой
+    expireQueue();
+    const QList<Pending> queue = m_queue;
+    m_queue.clear();
+    for (const Pending &pending : queue) {
+        if (!pending.context) continue;
+        if (m_state != Connected) {
+            m_queue.append(pending);
+            continue;
+        }
+        if (!pending.request()) {
+            qDebug() << "Отложенный запрос не выполнен после переподключения";
+            reportFailure();
+        }
+    }
+    scheduleExpiry();
+}
+
+void ConnectionSupervisor::expireQueue()
+{
+    int expired = 0;
+    for (int i = m_queue.size() - 1; i >= 0; --i) {
+        const Pending &pending = m_queue.at(i);
+        if (!pending.context) {
+            m_queue.removeAt(i);
+        } else if (pending.deadline.hasExpired()) {
+            m_queue.removeAt(i);
+            expired++;
+        }
+    }
+    scheduleExpiry();
+    if (expired > 0) {
+        qDebug() << "Отложенные запросы не дождались соединения:" << expired;
+        emit requestsExpired(expired);
+    }
+}
+
+void ConnectionSupervisor::scheduleExpiry()
+{
+    // Таймер настроен на ближайший срок в очереди
+    if (m_queue.isEmpty()) {
+        m_expiryTimer.stop();
+        return;
+    }
+    qint64 nearest = m_queue.first().deadline.remainingTime();
+    for (const Pending &pending : m_queue) {
+        nearest = qMin(nearest, pending.deadline.remainingTime());
+    }
+    m_expiryTimer.start(int(qMax<qint64>(0, nearest)));
+}
@@ -0,0 +1,127 @@
+#ifndef CONNECTIONSUPERVISOR_H
+#define CONNECTIONSUPERVISOR_H
+
+#include <QObject>
+#include <QDeadlineTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QPointer>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlTableModel>
+#include <QThread>
+#include <QTimer>
+#include <functional>
+
+// Проверка связи с сервером по собственному соединению в отдельном потоке:
+// open() и запрос к оборванному сокету могут ждать секундами, окно при этом
+// продолжает работать
+class ConnectionProbe : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ConnectionProbe(const QSqlDatabase &db);
+
+public slots:
+    void probe();
+    void shutdown();
+
+signals:
+    void probed(bool reachable);
+
+private:
+    QString m_driver;
+    QString m_database;
+    QString m_user;
+    QString m_password;
+    QString m_host;
+    QString m_options;
+    int m_port;
+};
+
+// Следит за соединением с сервером: проверяет его периодически и после ошибок,
+// переподключается с нарастающей задержкой, после восстановления заново готовит
+// закэшированные запросы, перечитывает открытые модели и выполняет отложенные чтения.
+class ConnectionSupervisor : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum State { Connected, Reconnecting };
+    enum { DefaultDeadlineMs = 10000 };
+
+    explicit ConnectionSupervisor(const QSqlDatabase &db, QObject *parent = nullptr);
+    ~ConnectionSupervisor();
+
+    void start();
+    State state() const { return m_state; }
+    bool isConnected() const { return m_state == Connected; }
+    qint64 lastRecoveryMs() const { return m_lastRecoveryMs; }
+
+    // Подготовленный запрос из кэша; после переподключения указатель меняется,
+    // поэтому брать его нужно заново при каждой попытке
+    QSqlQuery* prepared(const QString &sql);
+
+    // Выполняет request() сразу и не повторяет его. Пока связи нет, запрос не
+    // выполняется и возвращается false; после ошибки связь проверяется в фоне
+    bool run(const std::function<bool()> &request);
+
+    // Чтение, которое можно отложить: если связи нет или запрос не удался, он
+    // ждёт в очереди и выполняется один раз после переподключения. Запрос
+    // отбрасывается, если context удалён раньше или связь не восстановилась
+    // за deadlineMs (тогда приходит requestsExpired())
+    void enqueue(const std::function<bool()> &request, QObject *context, int deadlineMs = DefaultDeadlineMs);
+
+    // Ошибка запроса, выполненного в обход run(): запускает фоновую проверку связи
+    void reportFailure();
+
+    void watchModel(QSqlTableModel *model);
+
+public slots:
+    void checkConnection();
+
+signals:
+    void stateChanged(ConnectionSupervisor::State state);
+    void reconnected(qint64 recoveryMs);
+    // Отложенные запросы не дождались связи и отброшены
+    void requestsExpired(int count);
+
+private slots:
+    void onProbed(bool reachable);
+    void expireQueue();
+
+private:
+    struct Pending {
+        QPointer<QObject> context;
+        std::function<bool()> request;
+        QDeadlineTimer deadline;
+    };
+
+    QSqlDatabase m_db;
+    State m_state;
+    QTimer m_heartbeat;
+    QTimer m_retryTimer;
+    QTimer m_expiryTimer;
+    int m_backoffMs;
+    int m_attempts;
+    QElapsedTimer m_outage;
+    qint64 m_lastRecoveryMs;
+    QHash<QString, QSqlQuery*> m_statements;
+    QList<QPointer<QSqlTableModel>> m_models;
+    QList<Pending> m_queue;
+    QThread m_probeThread;
+    ConnectionProbe *m_probe;
+    bool m_probing;
+    bool m_suspect;  // запрос упал, ждём результата проверки
+
+    bool probeSession();
+    void scheduleExpiry();
+    void connectionLost();
+    bool reopen();
+    void restoreSession();
+    void runQueue();
+};
+
+#endif // CONNECTIONSUPERVISOR_H
@@ -1,14 +1,37 @@
 #include "database.h"
 #include <QApplication>
+#include <QDir>
+#include <QStandardPaths>
+#include <QSqlDriver>
+
+namespace {
+
+const QStringList WatchedTables = {"authors", "genres", "publishers", "readers", "books", "issues"};
+const int ChangeNotifyDelayMs = 200;
+
+} // namespace
 
 Database::Database(QObject *parent)
     : QObject(parent)
+    , m_backend(SqlBackend::create(SqlBackend::configuredName()))
 {
-    m_db = QSqlDatabase::addDatabase("QPSQL");
-    m_db.setDatabaseName("biblioteka");
-    m_db.setUserName("postgres");
-    m_db.setHostName("localhost");
-    m_db.setPort(5432);
+    m_db = QSqlDatabase::addDatabase(m_backend->driverName());
+    m_backend->configure(m_db);
+    m_journal = new OperationJournal(m_db, this);
+    m_journal->setMaxBindValues(m_backend->maxBindValues());
+    m_supervisor = new ConnectionSupervisor(m_db, this);
+    connect(m_supervisor, &ConnectionSupervisor::reconnected, this, &Database::subscribeToChanges);
+    
+    // Уведомления приходят по одному на оператор; копим их и отдаём пачкой
+    m_changeTimer.setSingleShot(true);
+    m_changeTimer.setInterval(ChangeNotifyDelayMs);
+    connect(&m_changeTimer, &QTimer::timeout, this, [this]() {
+        const QStringList tables = m_changedTables.values();
+        m_changedTables.clear();
+        for (const QString &table : tables) {
+            emit tableChanged(table);
+        }
+    });
 }
 
 Database::~Database()
@@ -16,6 +39,7 @@ Database::~Database()
     if (m_db.isOpen()) {
         m_db.close();
     }
+    delete m_backend;
 }
 
 bool Database::connectToDatabase()
@@ -26,162 +50,314 @@ bool Database::connectToDatabase()
         return false;
     }
     
-    qDebug() << "Подключение к базе данных успешно установлено";
-    return createTablesIfNotExist();
+    qDebug() << "Подключение к базе данных успешно установлено:" << m_backend->name();
+    
+    if (!m_backend->initSession(m_db)) {
+        QMessageBox::critical(nullptr, "Ошибка подключения",
+                             "Не удалось настроить соединение: " + m_db.lastError().text());
+        return false;
+    }
+    m_journal->setUpdateFromSupported(m_backend->supportsUpdateFrom());
+    
+    QString journalDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(journalDir);
+    m_journal->open(journalDir + "/journal.bin");
+    
+    if (!createTablesIfNotExist()) {
+        return false;
+    }
+    
+    subscribeToChanges();
+    // Встроенной базе сервер не нужен, следить за соединением незачем
+    if (!m_backend->isEmbedded()) {
+        m_supervisor->start();
+    }
+    return true;
 }
 
-QSqlTableModel* Database::getTableModel(const QString &tableName)
+QSqlTableModel* Database::getTableModel(const QString &tableName, const QString &filter)
 {
-    QSqlTableModel *model = new QSqlTableModel(this, m_db);
+    QSqlTableModel *model = new JournaledModel<QSqlTableModel>(m_journal, this, m_db);
     model->setTable(tableName);
     model->setEditStrategy(QSqlTableModel::OnFieldChange);
-    model->select();
+    model->setFilter(filter);
+    m_supervisor->watchModel(model);
+    m_supervisor->enqueue([model]() { return model->select(); }, model);
     return model;
 }
 
 bool Database::addBook(const QString &title, int authorId, int genreId, int publisherId, int year, int copies)
 {
-    QSqlQuery query(m_db);
-    query.prepare("INSERT INTO books (title, author_id, genre_id, publisher_id, publish_year, total_copies) "
-                  "VALUES (:title, :author_id, :genre_id, :publisher_id, :publish_year, :total_copies)");
-    query.bindValue(":title", title);
-    query.bindValue(":author_id", authorId);
-    query.bindValue(":genre_id", genreId);
-    query.bindValue(":publisher_id", publisherId);
-    query.bindValue(":publish_year", year);
-    query.bindValue(":total_copies", copies);
-    
-    if (!query.exec()) {
-        QMessageBox::warning(nullptr, "Ошибка", "Не удалось добавить книгу: " + query.lastError().text());
+    // Вставка не идемпотентна: при обрыве связи не повторяем её автоматически,
+    // это решает пользователь
+    bool returning = m_backend->supportsReturning();
+    QString sql = "INSERT INTO books (title, author_id, genre_id, publisher_id, publish_year, total_copies) "
+                  "VALUES (:title, :author_id, :genre_id, :publisher_id, :publish_year, :total_copies)";
+    if (returning) {
+        sql += " RETURNING book_id";
+    }
+    
+    QSqlQuery *query = nullptr;
+    bool success = m_supervisor->run([&]() {
+        query = m_supervisor->prepared(sql);
+        query->bindValue(":title", title);
+        query->bindValue(":author_id", authorId);
+        query->bindValue(":genre_id", genreId);
+        query->bindValue(":publisher_id", publisherId);
+        query->bindValue(":publish_year", year);
+        query->bindValue(":total_copies", copies);
+        return query->exec();
+    });
+    
+    if (!success) {
+        QMessageBox::warning(nullptr, "Ошибка", "Не удалось добавить книгу: "
+                             + errorText(query ? query->lastError().text() : QString()));
         return false;
     }
+    QVariant bookId = returning ? (query->next() ? query->value(0) : QVariant()) : query->lastInsertId();
+    if (bookId.isValid()) {
+        m_journal->recordInserted("books", bookId.toInt());
+    }
     return true;
 }
 
 bool Database::deleteRecord(const QString &tableName, int recordId)
 {
-    QSqlQuery query(m_db);
-    QString idColumn = "id";
-    if (tableName == "books") {
-        idColumn = "book_id";
+    return deleteRecords(tableName, {recordId});
+}
+
+bool Database::deleteRecords(const QString &tableName, const QList<int> &recordIds)
+{
+    if (recordIds.isEmpty()) return true;
+    
+    QString idColumn = m_journal->primaryKey(tableName);
+    if (idColumn.isEmpty()) {
+        QMessageBox::warning(nullptr, "Ошибка", "Не удалось определить первичный ключ таблицы " + tableName);
+        return false;
+    }
+    
+    QStringList ids;
+    for (int id : recordIds) {
+        ids << QString::number(id);
     }
-    query.prepare(QString("DELETE FROM %1 WHERE %2 = :id").arg(tableName, idColumn));
-    query.bindValue(":id", recordId);
     
-    if (!query.exec()) {
-        QMessageBox::warning(nullptr, "Ошибка", "Не удалось удалить запись: " + query.lastError().text());
+    QString error;
+    bool success = m_supervisor->run([&]() {
+        // Образы строк снимаются в той же транзакции, что и удаление
+        if (!m_db.transaction()) {
+            error = m_db.lastError().text();
+            return false;
+        }
+        m_journal->beginGroup(QString("Удаление записей (%1)").arg(recordIds.size()));
+        
+        // Удаляем, только если образ снят с каждой удаляемой строки: иначе
+        // отмена вернула бы не все строки
+        QSqlQuery query(m_db);
+        const int captured = m_journal->recordDeleting(tableName, recordIds);
+        if (captured < 0) {
+            error = m_journal->lastError();
+        } else if (!query.exec(QString("DELETE FROM %1 WHERE %2 IN (%3)").arg(tableName, idColumn, ids.join(", ")))) {
+            error = query.lastError().text();
+        } else if (query.numRowsAffected() != captured) {
+            error = "строки изменились во время удаления, повторите операцию";
+        } else if (m_db.commit()) {
+            m_journal->endGroup();
+            return true;
+        } else {
+            error = m_db.lastError().text();
+        }
+        
+        m_db.rollback();
+        m_journal->abortGroup();
+        return false;
+    });
+    
+    if (!success) {
+        QMessageBox::warning(nullptr, "Ошибка", "Не удалось удалить запись: " + errorText(error));
         return false;
     }
     return true;
 }
 
-QStringList Database::getAuthors()
+bool Database::submitChanges(QSqlTableModel *model, const QString &label)
 {
-    QStringList authors;
-    QSqlQuery query("SELECT full_name FROM authors ORDER BY full_name", m_db);
-    while (query.next()) {
-        authors << query.value(0).toString();
+    // Все правки сохраняются одной транзакцией и одним шагом отмены. После
+    // ошибки в середине submitAll() уже записанные строки считаются в модели
+    // сохранёнными, хотя транзакция откатана, и повторное сохранение их бы
+    // пропустило. Поэтому правки сбрасываются и таблица перечитывается
+    QString error;
+    bool reverted = false;
+    bool success = m_supervisor->run([&]() {
+        if (!m_db.transaction()) {
+            error = m_db.lastError().text();
+            return false;
+        }
+        m_journal->beginGroup(label);
+        if (model->submitAll() && m_db.commit()) {
+            m_journal->endGroup();
+            return true;
+        }
+        
+        error = model->lastError().isValid() ? model->lastError().text() : m_db.lastError().text();
+        m_db.rollback();
+        m_journal->abortGroup();
+        model->revertAll();
+        model->select();
+        reverted = true;
+        return false;
+    });
+    
+    if (!success) {
+        QString message = "Не удалось сохранить изменения: " + errorText(error);
+        if (reverted) {
+            message += "\nНесохранённые правки отменены, таблица перечитана из базы";
+        }
+        QMessageBox::warning(nullptr, "Ошибка", message);
     }
-    return authors;
+    return success;
 }
 
-QStringList Database::getGenres()
+bool Database::undo()
 {
-    QStringList genres;
-    QSqlQuery query("SELECT name FROM genres ORDER BY name", m_db);
-    while (query.next()) {
-        genres << query.value(0).toString();
-    }
-    return genres;
+    // Через супервизор, чтобы ошибка из-за обрыва связи запустила переподключение
+    return m_supervisor->run([this]() { return m_journal->undo(); });
 }
 
-QStringList Database::getPublishers()
+bool Database::redo()
 {
-    QStringList publishers;
-    QSqlQuery query("SELECT name FROM publishers ORDER BY name", m_db);
-    while (query.next()) {
-        publishers << query.value(0).toString();
-    }
-    return publishers;
+    return m_supervisor->run([this]() { return m_journal->redo(); });
 }
 
-QMap<int, QString> Database::getAuthorsMap()
+void Database::requestAuthors(QObject *context, const StringsCallback &done)
 {
-    QMap<int, QString> authors;
-    QSqlQuery query("SELECT author_id, full_name FROM authors ORDER BY full_name", m_db);
-    while (query.next()) {
-        authors[query.value(0).toInt()] = query.value(1).toString();
-    }
-    return authors;
+    fetchStrings("SELECT full_name FROM authors ORDER BY full_name", context, done);
 }
 
-QMap<int, QString> Database::getGenresMap()
+void Database::requestGenres(QObject *context, const StringsCallback &done)
 {
-    QMap<int, QString> genres;
-    QSqlQuery query("SELECT genre_id, name FROM genres ORDER BY name", m_db);
-    while (query.next()) {
-        genres[query.value(0).toInt()] = query.value(1).toString();
-    }
-    return genres;
+    fetchStrings("SELECT name FROM genres ORDER BY name", context, done);
 }
 
-QMap<int, QString> Database::getPublishersMap()
+void Database::requestPublishers(QObject *context, const StringsCallback &done)
 {
-    QMap<int, QString> publishers;
-    QSqlQuery query("SELECT publisher_id, name FROM publishers ORDER BY name", m_db);
-    while (query.next()) {
-        publishers[query.value(0).toInt()] = query.value(1).toString();
-    }
-    return publishers;
+    fetchStrings("SELECT name FROM publishers ORDER BY name", context, done);
 }
 
-bool Database::createTablesIfNotExist()
+void Database::requestAuthorsMap(QObject *context, const MapCallback &done)
 {
-    QSqlQuery query(m_db);
-    
-    // Создание таблицы авторов
-    if (!query.exec("CREATE TABLE IF NOT EXISTS authors ("
-                   "author_id SERIAL PRIMARY KEY, "
-                   "name VARCHAR(255) NOT NULL)")) {
-        qDebug() << "Ошибка создания таблицы authors:" << query.lastError().text();
-        return false;
+    fetchMap("SELECT author_id, full_name FROM authors ORDER BY full_name", context, done);
+}
+
+void Database::requestGenresMap(QObject *context, const MapCallback &done)
+{
+    fetchMap("SELECT genre_id, name FROM genres ORDER BY name", context, done);
+}
+
+void Database::requestPublishersMap(QObject *context, const MapCallback &done)
+{
+    fetchMap("SELECT publisher_id, name FROM publishers ORDER BY name", context, done);
+}
+
+void Database::fetchStrings(const QString &sql, QObject *context, const StringsCallback &done)
+{
+    // Чтение идемпотентно: при обрыве связи оно ждёт в очереди супервизора,
+    // и done вызывается после переподключения
+    m_supervisor->enqueue([this, sql, done]() {
+        QSqlQuery *query = m_supervisor->prepared(sql);
+        if (!query->exec()) return false;
+        QStringList values;
+        while (query->next()) {
+            values << query->value(0).toString();
+        }
+        done(values);
+        return true;
+    }, context);
+}
+
+void Database::fetchMap(const QString &sql, QObject *context, const MapCallback &done)
+{
+    m_supervisor->enqueue([this, sql, done]() {
+        QSqlQuery *query = m_supervisor->prepared(sql);
+        if (!query->exec()) return false;
+        QMap<int, QString> values;
+        while (query->next()) {
+            values[query->value(0).toInt()] = query->value(1).toString();
+        }
+        done(values);
+        return true;
+    }, context);
+}
+
+QStringList Database::searchColumns(const QString &tableName)
+{
+    auto it = m_searchColumns.constFind(tableName);
+    if (it != m_searchColumns.constEnd()) {
+        return it.value();
     }
     
-    // Создание таблицы жанров
-    if (!query.exec("CREATE TABLE IF NOT EXISTS genres ("
-                   "genre_id SERIAL PRIMARY KEY, "
-                   "name VARCHAR(255) NOT NULL)")) {
-        qDebug() << "Ошибка создания таблицы genres:" << query.lastError().text();
-        return false;
+    // Ищем только по тем текстовым столбцам, что есть в таблице
+    QStringList columns;
+    const QSqlRecord record = m_db.record(tableName);
+    for (const QString &name : {"title", "name", "full_name"}) {
+        if (record.contains(name)) {
+            columns << name;
+        }
     }
-    
-    // Создание таблицы издательств
-    if (!query.exec("CREATE TABLE IF NOT EXISTS publishers ("
-                   "publisher_id SERIAL PRIMARY KEY, "
-                   "name VARCHAR(255) NOT NULL)")) {
-        qDebug() << "Ошибка создания таблицы publishers:" << query.lastError().text();
-        return false;
+    if (!record.isEmpty()) {
+        m_searchColumns.insert(tableName, columns);
+    }
+    return columns;
+}
+
+QString Database::searchFilter(const QString &tableName, const QString &text)
+{
+    return m_backend->searchFilter(tableName, searchColumns(tableName), text);
+}
+
+void Database::subscribeToChanges()
+{
+    QSqlDriver *driver = m_db.driver();
+    const QStringList channels = m_backend->notificationChannels(WatchedTables);
+    if (channels.isEmpty() || !driver->hasFeature(QSqlDriver::EventNotifications)) {
+        return;
     }
     
-    // Создание таблицы читателей
-    if (!query.exec("CREATE TABLE IF NOT EXISTS readers ("
-                   "reader_id SERIAL PRIMARY KEY, "
-                   "name VARCHAR(255) NOT NULL, "
-                   "email VARCHAR(255))")) {
-        qDebug() << "Ошибка создания таблицы readers:" << query.lastError().text();
-        return false;
+    // После переподключения подписки сервера потеряны, оформляем их заново
+    for (const QString &channel : channels) {
+        driver->unsubscribeFromNotification(channel);
+        driver->subscribeToNotification(channel);
+    }
+    connect(driver, QOverload<const QString &, QSqlDriver::NotificationSource, const QVariant &>::of(&QSqlDriver::notification),
+            this, &Database::onNotification, Qt::UniqueConnection);
+}
+
+void Database::onNotification(const QString &name, QSqlDriver::NotificationSource source, const QVariant &payload)
+{
+    // Свои изменения окно и так перечитывает, сообщаем только о чужих
+    if (!m_backend->isExternalChange(source)) {
+        return;
+    }
+    m_changedTables.insert(m_backend->changedTable(name, payload));
+    if (!m_changeTimer.isActive()) {
+        m_changeTimer.start();
+    }
+}
+
+QString Database::errorText(const QString &error) const
+{
+    if (!m_supervisor->isConnected()) {
+        return "нет соединения с сервером, повторите после его восстановления";
     }
+    return error;
+}
+
+bool Database::createTablesIfNotExist()
+{
+    QSqlQuery query(m_db);
     
-    // Создание таблицы книг
-    if (!query.exec("CREATE TABLE IF NOT EXISTS books ("
-                   "book_id SERIAL PRIMARY KEY, "
-                   "title VARCHAR(255) NOT NULL, "
-                   "author_id INTEGER REFERENCES authors(author_id), "
-                   "genre_id INTEGER REFERENCES genres(genre_id), "
-                   "publisher_id INTEGER REFERENCES publishers(publisher_id), "
-                   "publish_year INTEGER, "
-                   "total_copies INTEGER DEFAULT 1)")) {
-        qDebug() << "Ошибка создания таблицы books:" << query.lastError().text();
+    // Таблицы создаются на диалекте выбранной СУБД, тестовые данные общие
+    if (!m_backend->createSchema(m_db)) {
+        qDebug() << "Ошибка создания таблиц:" << m_db.lastError().text();
         return false;
     }
     
@@ -211,17 +387,20 @@ bool Database::saveRecord(const QString &tableName, int recordId)
 {
     // Для QSqlTableModel изменения сохраняются автоматически при редактировании
     // Эта функция может быть использована для дополнительной валидации или логирования
-    QSqlQuery query(m_db);
-    query.prepare(QString("SELECT COUNT(*) FROM %1 WHERE %2 = :id")
-                  .arg(tableName, tableName == "books" ? "book_id" : "id"));
-    query.bindValue(":id", recordId);
+    QSqlQuery *query = nullptr;
+    bool success = m_supervisor->run([&]() {
+        query = m_supervisor->prepared(QString("SELECT COUNT(*) FROM %1 WHERE %2 = :id")
+                                       .arg(tableName, tableName == "books" ? "book_id" : "id"));
+        query->bindValue(":id", recordId);
+        return query->exec() && query->next();
+    });
     
-    if (!query.exec() || !query.next()) {
+    if (!success) {
         QMessageBox::warning(nullptr, "Ошибка", "Не удалось проверить существование записи");
         return false;
     }
     
-    if (query.value(0).toInt() == 0) {
+    if (query->value(0).toInt() == 0) {
         QMessageBox::warning(nullptr, "Ошибка", "Запись не найдена");
         return false;
     }
@@ -8,6 +8,13 @@
 #include <QSqlError>
 #include <QDebug>
 #include <QMessageBox>
+#include "operationjournal.h"
+#include "connectionsupervisor.h"
+#include "sqlbackend.h"
+#include <QSet>
+#include <QSqlDriver>
+#include <QTimer>
+#include <functional>
 
 class Database : public QObject
 {
@@ -18,20 +25,63 @@ public:
     ~Database();
 
     bool connectToDatabase();
-    QSqlTableModel* getTableModel(const QString &tableName);
+    QSqlDatabase database() const { return m_db; }
+    // Модель читается сразу с условием filter, через очередь супервизора
+    QSqlTableModel* getTableModel(const QString &tableName, const QString &filter = QString());
     bool addBook(const QString &title, int authorId, int genreId, int publisherId, int year, int copies);
     bool deleteRecord(const QString &tableName, int recordId);
+    bool deleteRecords(const QString &tableName, const QList<int> &recordIds);
     bool saveRecord(const QString &tableName, int recordId);
-    QStringList getAuthors();
-    QStringList getGenres();
-    QStringList getPublishers();
-    QMap<int, QString> getAuthorsMap();
-    QMap<int, QString> getGenresMap();
-    QMap<int, QString> getPublishersMap();
+    // Сохраняет правки модели одной транзакцией и одним шагом отмены; если
+    // запись не удалась, правки модели сбрасываются
+    bool submitChanges(QSqlTableModel *model, const QString &label);
+
+    // Справочники читаются через очередь супервизора: done вызывается сразу или
+    // после переподключения и не вызывается, если context к тому времени удалён
+    using StringsCallback = std::function<void(const QStringList &)>;
+    using MapCallback = std::function<void(const QMap<int, QString> &)>;
+    void requestAuthors(QObject *context, const StringsCallback &done);
+    void requestGenres(QObject *context, const StringsCallback &done);
+    void requestPublishers(QObject *context, const StringsCallback &done);
+    void requestAuthorsMap(QObject *context, const MapCallback &done);
+    void requestGenresMap(QObject *context, const MapCallback &done);
+    void requestPublishersMap(QObject *context, const MapCallback &done);
+
+    SqlBackend* backend() const { return m_backend; }
+    // Столбцы, по которым ищет строка поиска (и на сервере, и на клиенте)
+    QStringList searchColumns(const QString &tableName);
+    QString searchFilter(const QString &tableName, const QString &text);
+
+    // Журнал отмены: операции между beginOperation() и endOperation() отменяются одним шагом
+    OperationJournal* journal() const { return m_journal; }
+    void beginOperation(const QString &label) { m_journal->beginGroup(label); }
+    void endOperation() { m_journal->endGroup(); }
+    void abortOperation() { m_journal->abortGroup(); }
+    bool undo();
+    bool redo();
+
+    ConnectionSupervisor* supervisor() const { return m_supervisor; }
+
+signals:
+    // Таблицу изменил другой клиент
+    void tableChanged(const QString &tableName);
+
+private slots:
+    void subscribeToChanges();
+    void onNotification(const QString &name, QSqlDriver::NotificationSource source, const QVariant &payload);
 
 private:
+    SqlBackend *m_backend;
     QSqlDatabase m_db;
+    OperationJournal *m_journal;
+    ConnectionSupervisor *m_supervisor;
+    QTimer m_changeTimer;
+    QSet<QString> m_changedTables;
+    QHash<QString, QStringList> m_searchColumns;
     bool createTablesIfNotExist();
+    void fetchStrings(const QString &sql, QObject *context, const StringsCallback &done);
+    void fetchMap(const QString &sql, QObject *context, const MapCallback &done);
+    QString errorText(const QString &error) const;
 };
 
 #endif // DATABASE_H 
\ No newline at end of file
@@ -1,7 +1,13 @@
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
 #include <QHeaderView>
-#include <QSqlRelationalDelegate>
+#include <QMenu>
+#include <QDialog>
+#include <QDialogButtonBox>
+#include <QDateEdit>
+#include <QFormLayout>
+#include <QFileDialog>
+#include <QApplication>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -9,6 +15,8 @@ MainWindow::MainWindow(QWidget *parent)
     , m_db(new Database(this))
     , m_currentModel(nullptr)
     , m_booksRelModel(nullptr)
+    , m_reports(new ReportEngine(m_db, this))
+    , m_proxy(new ClientQueryModel(this))
 {
     ui->setupUi(this);
     
@@ -55,9 +63,15 @@ void MainWindow::setupUI()
     m_tableView = new QTableView(this);
     m_tableView->setAlternatingRowColors(true);
     m_tableView->setSelectionBehavior(QAbstractItemView::SelectRows);
-    m_tableView->setSelectionMode(QAbstractItemView::SingleSelection);
+    m_tableView->setSelectionMode(QAbstractItemView::ExtendedSelection);
     m_tableView->setEditTriggers(QAbstractItemView::DoubleClicked | QAbstractItemView::SelectedClicked);
     m_tableView->setToolTip("Двойной клик — редактировать запись");
+    // Сортировка по щелчку на заголовке и уточнение поиска выполняются
+    // на клиенте по уже загруженным строкам
+    m_tableView->setModel(m_proxy);
+    m_tableView->setItemDelegate(new ProxyRelationalDelegate(m_tableView));
+    m_tableView->horizontalHeader()->setSortIndicator(-1, Qt::AscendingOrder);
+    m_tableView->setSortingEnabled(true);
     mainLayout->addWidget(m_tableView);
     // Кнопки
     QHBoxLayout *buttonLayout = new QHBoxLayout();
@@ -67,9 +81,22 @@ void MainWindow::setupUI()
     m_deleteButton->setToolTip("Удалить выбранную запись");
     m_saveButton = new QPushButton("Сохранить", this);
     m_saveButton->setToolTip("Сохранить изменения в таблице");
+    m_undoButton = new QPushButton("Отменить", this);
+    m_undoButton->setShortcut(QKeySequence::Undo);
+    m_redoButton = new QPushButton("Повторить", this);
+    m_redoButton->setShortcut(QKeySequence::Redo);
+    m_reportButton = new QPushButton("Отчёты", this);
+    m_reportButton->setToolTip("Сформировать отчёт по истории выдач (HTML или CSV)");
+    QMenu *reportMenu = new QMenu(m_reportButton);
+    reportMenu->addAction("Просроченные выдачи...", this, &MainWindow::onOverdueReportClicked);
+    reportMenu->addAction("Активность читателей...", this, &MainWindow::onActivityReportClicked);
+    m_reportButton->setMenu(reportMenu);
     buttonLayout->addWidget(m_addButton);
     buttonLayout->addWidget(m_deleteButton);
     buttonLayout->addWidget(m_saveButton);
+    buttonLayout->addWidget(m_undoButton);
+    buttonLayout->addWidget(m_redoButton);
+    buttonLayout->addWidget(m_reportButton);
     buttonLayout->addStretch();
     mainLayout->addLayout(buttonLayout);
     // Сигналы
@@ -77,6 +104,14 @@ void MainWindow::setupUI()
     connect(m_addButton, &QPushButton::clicked, this, &MainWindow::onAddClicked);
     connect(m_deleteButton, &QPushButton::clicked, this, &MainWindow::onDeleteClicked);
     connect(m_saveButton, &QPushButton::clicked, this, &MainWindow::onSaveClicked);
+    connect(m_undoButton, &QPushButton::clicked, this, &MainWindow::onUndoClicked);
+    connect(m_redoButton, &QPushButton::clicked, this, &MainWindow::onRedoClicked);
+    connect(m_db->journal(), &OperationJournal::changed, this, &MainWindow::updateUndoButtons);
+    connect(m_db->supervisor(), &ConnectionSupervisor::stateChanged, this, &MainWindow::onConnectionStateChanged);
+    connect(m_db->supervisor(), &ConnectionSupervisor::reconnected, this, &MainWindow::onReconnected);
+    connect(m_db->supervisor(), &ConnectionSupervisor::requestsExpired, this, &MainWindow::onRequestsExpired);
+    connect(m_db, &Database::tableChanged, this, &MainWindow::onExternalTableChange);
+    updateUndoButtons();
     connect(m_searchEdit, &QLineEdit::textChanged, this, &MainWindow::onSearchTextChanged);
 }
 
@@ -86,15 +121,38 @@ void MainWindow::setupBooksRelationalModel()
         delete m_booksRelModel;
         m_booksRelModel = nullptr;
     }
-    m_booksRelModel = new QSqlRelationalTableModel(this, QSqlDatabase::database());
+    m_booksRelModel = new JournaledModel<QSqlRelationalTableModel>(m_db->journal(), this, m_db->database());
     m_booksRelModel->setTable("books");
     m_booksRelModel->setEditStrategy(QSqlTableModel::OnManualSubmit);
     m_booksRelModel->setRelation(2, QSqlRelation("genres", "genre_id", "name"));
     m_booksRelModel->setRelation(3, QSqlRelation("authors", "author_id", "full_name"));
     m_booksRelModel->setRelation(4, QSqlRelation("publishers", "publisher_id", "name"));
-    m_booksRelModel->select();
-    m_tableView->setModel(m_booksRelModel);
-    m_tableView->setItemDelegate(new QSqlRelationalDelegate(m_tableView));
+    // Условие поиска задаётся до первого чтения, чтобы не читать таблицу дважды
+    m_booksRelModel->setFilter(m_db->searchFilter("books", m_serverSearchText));
+    m_db->supervisor()->watchModel(m_booksRelModel);
+    QSqlRelationalTableModel *model = m_booksRelModel;
+    m_db->supervisor()->enqueue([model]() { return model->select(); }, model);
+    setProxySource(m_booksRelModel);
+}
+
+void MainWindow::setProxySource(QSqlTableModel *model)
+{
+    m_tableView->horizontalHeader()->setSortIndicator(-1, Qt::AscendingOrder);
+    m_proxy->setSourceModel(model);
+    if (!model) return;
+
+    // Те же столбцы, по которым ищет сервер: клиент лишь досматривает его выборку
+    QVector<int> columns;
+    for (const QString &name : m_db->searchColumns(model->tableName())) {
+        columns << model->record().indexOf(name);
+    }
+    m_proxy->setFilterColumns(columns);
+}
+
+void MainWindow::showSearchStatus()
+{
+    statusBar()->showMessage(QString("Найдено записей: %1 (%2 мс)")
+                                 .arg(m_proxy->rowCount()).arg(m_proxy->lastQueryMs()), 5000);
 }
 
 void MainWindow::onTableChanged(const QString &tableName)
@@ -105,6 +163,7 @@ void MainWindow::onTableChanged(const QString &tableName)
 void MainWindow::loadTable(const QString &tableName)
 {
     // Очищаем старые модели
+    setProxySource(nullptr);
     if (m_currentModel) {
         delete m_currentModel;
         m_currentModel = nullptr;
@@ -114,12 +173,14 @@ void MainWindow::loadTable(const QString &tableName)
         m_booksRelModel = nullptr;
     }
     
+    // Новая модель сразу отбирается на сервере по тексту строки поиска
+    m_serverSearchText = m_searchEdit->text();
+    
     if (tableName == "Книги") {
         setupBooksRelationalModel();
         updateTableHeaders();
         m_tableView->resizeColumnsToContents();
         m_tableView->horizontalHeader()->setStretchLastSection(true);
-        applyBookFilter(m_searchEdit->text());
     } else {
         QString dbTableName;
         if (tableName == "Авторы") dbTableName = "authors";
@@ -129,14 +190,16 @@ void MainWindow::loadTable(const QString &tableName)
         else if (tableName == "Выдачи") dbTableName = "issues";
         else return;
         
-        m_currentModel = m_db->getTableModel(dbTableName);
+        m_currentModel = m_db->getTableModel(dbTableName, m_db->searchFilter(dbTableName, m_serverSearchText));
         if (m_currentModel) {
-            m_tableView->setModel(m_currentModel);
+            setProxySource(m_currentModel);
             updateTableHeaders();
             m_tableView->resizeColumnsToContents();
             m_tableView->horizontalHeader()->setStretchLastSection(true);
         }
     }
+
+    m_proxy->setTextFilter(SqlBackend::searchWords(m_serverSearchText));
 }
 
 void MainWindow::updateTableHeaders()
@@ -193,23 +256,24 @@ void MainWindow::onAddClicked()
 
 void MainWindow::onDeleteClicked()
 {
-    QModelIndex currentIndex = m_tableView->currentIndex();
-    if (!currentIndex.isValid()) {
+    QModelIndexList selectedRows = m_tableView->selectionModel()
+                                   ? m_tableView->selectionModel()->selectedRows()
+                                   : QModelIndexList();
+    if (selectedRows.isEmpty()) {
         QMessageBox::warning(this, "Предупреждение", "Выберите запись для удаления");
         return;
     }
     
-    int row = currentIndex.row();
-    int recordId = 0;
-    
-    if (m_tableCombo->currentText() == "Книги" && m_booksRelModel) {
-        recordId = m_booksRelModel->data(m_booksRelModel->index(row, 0)).toInt();
-    } else if (m_currentModel) {
-        recordId = m_currentModel->data(m_currentModel->index(row, 0)).toInt();
-    } else {
+    if (!m_booksRelModel && !m_currentModel) {
         return;
     }
     
+    // Строки выделены в прокси, поэтому id берём через него, а не по номеру строки источника
+    QList<int> recordIds;
+    for (const QModelIndex &index : selectedRows) {
+        recordIds << index.sibling(index.row(), 0).data().toInt();
+    }
+    
     QString tableName = m_tableCombo->currentText();
     QString dbTableName;
     if (tableName == "Книги") dbTableName = "books";
@@ -221,13 +285,14 @@ void MainWindow::onDeleteClicked()
     else return;
     
     QMessageBox::StandardButton reply = QMessageBox::question(this, "Подтверждение", 
-                                                              "Вы уверены, что хотите удалить эту запись?",
+                                                              QString("Вы уверены, что хотите удалить выбранные записи (%1)?")
+                                                                  .arg(recordIds.size()),
                                                               QMessageBox::Yes | QMessageBox::No);
     
     if (reply == QMessageBox::Yes) {
-        if (m_db->deleteRecord(dbTableName, recordId)) {
+        if (m_db->deleteRecords(dbTableName, recordIds)) {
             loadTable(tableName);
-            QMessageBox::information(this, "Успех", "Запись успешно удалена");
+            QMessageBox::information(this, "Успех", "Записи удалены. Отменить удаление можно кнопкой \"Отменить\"");
         }
     }
 }
@@ -236,44 +301,174 @@ void MainWindow::onSaveClicked()
 {
     bool success = false;
     
+    // Все правки, сохраняемые за одно нажатие, отменяются одним шагом
     if (m_tableCombo->currentText() == "Книги" && m_booksRelModel) {
-        success = m_booksRelModel->submitAll();
+        success = m_db->submitChanges(m_booksRelModel, "Сохранение изменений");
     } else if (m_currentModel) {
-        success = m_currentModel->submitAll();
+        success = m_db->submitChanges(m_currentModel, "Сохранение изменений");
     }
     
     if (success) {
         QMessageBox::information(this, "Успех", "Изменения успешно сохранены");
         loadTable(m_tableCombo->currentText()); // Обновляем таблицу
-    } else {
-        QMessageBox::warning(this, "Ошибка", "Не удалось сохранить изменения");
     }
 }
 
 void MainWindow::onSearchTextChanged(const QString &text)
 {
-    if (m_tableCombo->currentText() == "Книги" && m_booksRelModel) {
-        applyBookFilter(text);
-    } else if (m_currentModel) {
-        QString filter;
-        if (!text.isEmpty()) {
-            // Простой поиск по первой текстовой колонке
-            filter = QString("name ILIKE '%%1%' OR full_name ILIKE '%%1%' OR title ILIKE '%%1%'").arg(text);
-        }
-        m_currentModel->setFilter(filter);
-        m_currentModel->select();
+    QSqlTableModel *model = m_booksRelModel ? m_booksRelModel : m_currentModel;
+    if (!model) return;
+
+    // Уточнённый запрос сужает уже отобранную сервером выборку, поэтому
+    // досматривать её достаточно на клиенте. Без прежнего запроса сервер
+    // ничего не отбирал и таблица могла быть загружена не целиком, так что
+    // первый запрос, как и не уточняющий, уходит на сервер. Его условие шире
+    // клиентского, окончательно строки отбирает прокси
+    const QStringList words = SqlBackend::searchWords(text);
+    const QStringList serverWords = SqlBackend::searchWords(m_serverSearchText);
+    if (words != serverWords && (serverWords.isEmpty() || !SqlBackend::isSearchRefinement(serverWords, words))) {
+        m_serverSearchText = text;
+        m_proxy->setTextFilter(QStringList());
+        model->setFilter(m_db->searchFilter(model->tableName(), text));
+        m_db->supervisor()->enqueue([model]() { return model->select(); }, model);
+    }
+    m_proxy->setTextFilter(words);
+    showSearchStatus();
+}
+
+void MainWindow::onUndoClicked()
+{
+    if (m_db->undo()) {
+        loadTable(m_tableCombo->currentText());
+    }
+}
+
+void MainWindow::onRedoClicked()
+{
+    if (m_db->redo()) {
+        loadTable(m_tableCombo->currentText());
+    }
+}
+
+void MainWindow::updateUndoButtons()
+{
+    OperationJournal *journal = m_db->journal();
+    m_undoButton->setEnabled(journal->canUndo());
+    m_undoButton->setToolTip(journal->canUndo() ? "Отменить: " + journal->undoLabel() : "Нечего отменять");
+    m_redoButton->setEnabled(journal->canRedo());
+    m_redoButton->setToolTip(journal->canRedo() ? "Повторить: " + journal->redoLabel() : "Нечего повторять");
+}
+
+void MainWindow::onConnectionStateChanged(ConnectionSupervisor::State state)
+{
+    // Пока соединения нет, изменяющие операции недоступны; просмотр загруженных данных продолжает работать
+    bool connected = state == ConnectionSupervisor::Connected;
+    m_addButton->setEnabled(connected);
+    m_deleteButton->setEnabled(connected);
+    m_saveButton->setEnabled(connected);
+    m_reportButton->setEnabled(connected);
+    if (connected) {
+        updateUndoButtons();
+    } else {
+        m_undoButton->setEnabled(false);
+        m_redoButton->setEnabled(false);
+        statusBar()->showMessage("Соединение с сервером потеряно, выполняется переподключение...");
+    }
+}
+
+void MainWindow::onReconnected(qint64 recoveryMs)
+{
+    statusBar()->showMessage(QString("Соединение восстановлено за %1 мс").arg(recoveryMs), 10000);
+}
+
+void MainWindow::onRequestsExpired(int count)
+{
+    statusBar()->showMessage(QString("Не дождались соединения с сервером, данные не загружены (запросов: %1). "
+                                     "Откройте таблицу заново после восстановления").arg(count), 10000);
+}
+
+void MainWindow::onExternalTableChange(const QString &tableName)
+{
+    // Перечитываем открытую таблицу, только если в ней нет несохранённых правок
+    QSqlTableModel *model = m_booksRelModel ? m_booksRelModel : m_currentModel;
+    if (model && model->tableName() == tableName && !model->isDirty()) {
+        model->select();
+        statusBar()->showMessage("Таблица обновлена: данные изменены другим пользователем", 5000);
     }
 }
 
-void MainWindow::applyBookFilter(const QString &text)
+void MainWindow::onOverdueReportClicked()
 {
-    if (!m_booksRelModel) return;
+    QString fileName = askReportFile("overdue");
+    if (fileName.isEmpty()) return;
     
-    QString filter;
-    if (!text.isEmpty()) {
-        filter = QString("title ILIKE '%%1%'").arg(text);
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    QMetaObject::Connection progress = connect(m_reports, &ReportEngine::progress, this, &MainWindow::showReportProgress);
+    bool success = m_reports->writeOverdueReport(fileName, QDate::currentDate(), ReportEngine::DefaultLoanDays);
+    disconnect(progress);
+    QApplication::restoreOverrideCursor();
+    statusBar()->clearMessage();
+    
+    if (success) {
+        QMessageBox::information(this, "Успех", "Отчёт сохранён: " + fileName);
     }
+}
+
+void MainWindow::onActivityReportClicked()
+{
+    QDate from, to;
+    if (!askReportPeriod(from, to)) return;
+    
+    QString fileName = askReportFile("activity");
+    if (fileName.isEmpty()) return;
+    
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    QMetaObject::Connection progress = connect(m_reports, &ReportEngine::progress, this, &MainWindow::showReportProgress);
+    bool success = m_reports->writeActivityReport(fileName, from, to, ReportEngine::DefaultLoanDays);
+    disconnect(progress);
+    QApplication::restoreOverrideCursor();
+    statusBar()->clearMessage();
     
-    m_booksRelModel->setFilter(filter);
-    m_booksRelModel->select();
+    if (success) {
+        QMessageBox::information(this, "Успех", "Отчёт сохранён: " + fileName);
+    }
+}
+
+void MainWindow::showReportProgress(int rowsProcessed)
+{
+    statusBar()->showMessage(QString("Формирование отчёта: обработано выдач %1").arg(rowsProcessed));
+}
+
+bool MainWindow::askReportPeriod(QDate &from, QDate &to)
+{
+    QDialog dialog(this);
+    dialog.setWindowTitle("Период отчёта");
+    QFormLayout *layout = new QFormLayout(&dialog);
+    QDateEdit *fromEdit = new QDateEdit(QDate::currentDate().addYears(-1), &dialog);
+    QDateEdit *toEdit = new QDateEdit(QDate::currentDate(), &dialog);
+    fromEdit->setCalendarPopup(true);
+    toEdit->setCalendarPopup(true);
+    layout->addRow("С:", fromEdit);
+    layout->addRow("По:", toEdit);
+    QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &dialog);
+    layout->addRow(buttons);
+    connect(buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+    
+    if (dialog.exec() != QDialog::Accepted) return false;
+    
+    from = fromEdit->date();
+    to = toEdit->date();
+    if (from > to) {
+        QMessageBox::warning(this, "Предупреждение", "Начало периода позже его окончания");
+        return false;
+    }
+    return true;
+}
+
+QString MainWindow::askReportFile(const QString &baseName)
+{
+    return QFileDialog::getSaveFileName(this, "Сохранить отчёт",
+                                        baseName + "_" + QDate::currentDate().toString("yyyyMMdd") + ".html",
+                                        "HTML (*.html);;CSV (*.csv)");
 }
@@ -14,6 +14,8 @@
 #include <QLineEdit>
 #include "database.h"
 #include "addbookdialog.h"
+#include "reportengine.h"
+#include "clientquerymodel.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -35,6 +37,16 @@ private slots:
     void onDeleteClicked();
     void onSearchTextChanged(const QString &text);
     void onSaveClicked();
+    void onUndoClicked();
+    void onRedoClicked();
+    void updateUndoButtons();
+    void onConnectionStateChanged(ConnectionSupervisor::State state);
+    void onReconnected(qint64 recoveryMs);
+    void onRequestsExpired(int count);
+    void showReportProgress(int rowsProcessed);
+    void onExternalTableChange(const QString &tableName);
+    void onOverdueReportClicked();
+    void onActivityReportClicked();
 
 private:
     Ui::MainWindow *ui;
@@ -44,14 +56,23 @@ private:
     QPushButton *m_addButton;
     QPushButton *m_deleteButton;
     QPushButton *m_saveButton;
+    QPushButton *m_undoButton;
+    QPushButton *m_redoButton;
+    QPushButton *m_reportButton;
     QLineEdit *m_searchEdit;
     QSqlTableModel *m_currentModel;
     QSqlRelationalTableModel *m_booksRelModel;
+    ReportEngine *m_reports;
+    ClientQueryModel *m_proxy;
+    QString m_serverSearchText;   // условие, по которому отобраны строки на сервере
     
     void setupUI();
     void loadTable(const QString &tableName);
     void updateTableHeaders();
     void setupBooksRelationalModel();
-    void applyBookFilter(const QString &text);
+    void setProxySource(QSqlTableModel *model);
+    void showSearchStatus();
+    bool askReportPeriod(QDate &from, QDate &to);
+    QString askReportFile(const QString &baseName);
 };
 #endif // MAINWINDOW_H
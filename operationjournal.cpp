@@ -0,0 +1,642 @@
+#include "operationjournal.h"
+#include <QDataStream>
+#include <QMessageBox>
+#include <QSqlError>
+#include <QSqlField>
+#include <QSqlIndex>
+#include <QSqlQuery>
+#include <QSet>
+#include <QDebug>
+
+namespace {
+
+const quint32 JournalMagic = 0x504A4E4C; // "PJNL"
+const quint16 JournalVersion = 1;
+const int MaxUndoGroups = 100;
+const int DefaultMaxBindValues = 999;
+const int MaxKeysPerStatement = 1000;
+
+// Теги записей в файле журнала
+const quint8 TagSession = 'S';
+const quint8 TagTable = 'T';
+const quint8 TagGroup = 'G';
+const quint8 TagUndone = 'U';
+const quint8 TagRedone = 'R';
+
+QVariantList recordValues(const QSqlRecord &record)
+{
+    QVariantList values;
+    values.reserve(record.count());
+    for (int i = 0; i < record.count(); ++i) {
+        values << record.value(i);
+    }
+    return values;
+}
+
+QString placeholders(int count)
+{
+    QStringList marks;
+    marks.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        marks << "?";
+    }
+    return "(" + marks.join(", ") + ")";
+}
+
+// Параметр с типом столбца. QPSQL готовит запрос через PREPARE без типов
+// параметров, и сервер считает столбец VALUES из одних параметров текстовым
+// раньше, чем сверяет его с первой частью UNION
+QString typedMark(const QSqlField &field)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    const int type = field.metaType().id();
+#else
+    const int type = int(field.type());
+#endif
+    switch (type) {
+    case QMetaType::Bool:
+        return "CAST(? AS BOOLEAN)";
+    case QMetaType::Short:
+    case QMetaType::UShort:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+        return "CAST(? AS INTEGER)";
+    case QMetaType::Long:
+    case QMetaType::ULong:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+        return "CAST(? AS BIGINT)";
+    case QMetaType::Float:
+    case QMetaType::Double:
+        return "CAST(? AS DOUBLE PRECISION)";
+    case QMetaType::QDate:
+        return "CAST(? AS DATE)";
+    case QMetaType::QTime:
+        return "CAST(? AS TIME)";
+    case QMetaType::QDateTime:
+        return "CAST(? AS TIMESTAMP)";
+    case QMetaType::QString:
+        return "CAST(? AS TEXT)";
+    default:
+        return "?";
+    }
+}
+
+// Строки с типами столбцов таблицы: пустая выборка из неё задаёт имена и
+// типы объединения, marks — параметры строки, приведённые к этим типам
+QString rowSet(const QString &table, const QStringList &columns, const QStringList &marks, int rows)
+{
+    QStringList values;
+    const QString rowMarks = "(" + marks.join(", ") + ")";
+    for (int i = 0; i < rows; ++i) {
+        values << rowMarks;
+    }
+    const QString list = columns.join(", ");
+    return QString("SELECT %1 FROM %2 WHERE 1 = 0 UNION ALL VALUES %3").arg(list, table, values.join(", "));
+}
+
+// Строка таблицы совпадает с ожидаемым образом во всех столбцах, NULL равен NULL.
+// Ключ сравнивается простым равенством, чтобы сервер соединял по индексу
+QString sameRow(const QString &table, const QString &key, const QStringList &columns, const QString &expected)
+{
+    QStringList conditions;
+    conditions << QString("%1.%3 = %2.%3").arg(table, expected, key);
+    for (const QString &column : columns) {
+        if (column == key) continue;
+        conditions << QString("(%1.%3 = %2.%3 OR (%1.%3 IS NULL AND %2.%3 IS NULL))")
+                      .arg(table, expected, column);
+    }
+    return conditions.join(" AND ");
+}
+
+} // namespace
+
+OperationJournal::OperationJournal(const QSqlDatabase &db, QObject *parent)
+    : QObject(parent)
+    , m_db(db)
+    , m_depth(0)
+    , m_nextId(1)
+    , m_maxBindValues(DefaultMaxBindValues)
+    , m_updateFrom(true)
+{
+}
+
+OperationJournal::~OperationJournal()
+{
+    if (m_file.isOpen()) {
+        m_file.close();
+    }
+}
+
+bool OperationJournal::open(const QString &fileName)
+{
+    // Файл только дописывается; история отмены держится в памяти в пределах сеанса
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qDebug() << "Не удалось открыть журнал операций:" << m_file.errorString();
+        return false;
+    }
+
+    QDataStream out(&m_file);
+    out.setVersion(QDataStream::Qt_5_12);
+    if (m_file.size() == 0) {
+        out << JournalMagic << JournalVersion;
+    }
+    out << TagSession << QDateTime::currentMSecsSinceEpoch();
+    m_file.flush();
+    return true;
+}
+
+void OperationJournal::beginGroup(const QString &label)
+{
+    if (m_depth++ == 0) {
+        m_current = Group();
+        m_current.label = label;
+    }
+}
+
+void OperationJournal::endGroup()
+{
+    if (m_depth == 0 || --m_depth > 0) {
+        return;
+    }
+    if (!m_current.entries.isEmpty()) {
+        push(m_current);
+    }
+    m_current = Group();
+}
+
+void OperationJournal::abortGroup()
+{
+    // Отмена вложенной группы отменяет и все внешние: их транзакция уже откатана
+    m_depth = 0;
+    m_current = Group();
+}
+
+QString OperationJournal::primaryKey(const QString &table)
+{
+    auto it = m_keys.constFind(table);
+    if (it != m_keys.constEnd()) {
+        return it.value();
+    }
+    const QSqlIndex index = m_db.primaryIndex(table);
+    const QString key = index.count() == 1 ? index.fieldName(0) : QString();
+    // Пустой ответ может означать обрыв связи, такой результат не кэшируем
+    if (!key.isEmpty()) {
+        m_keys.insert(table, key);
+    }
+    return key;
+}
+
+void OperationJournal::recordInserted(const QString &table, int key)
+{
+    const QString keyColumn = primaryKey(table);
+    if (keyColumn.isEmpty()) return;
+
+    QVector<QSqlRecord> rows;
+    if (!fetchRows(table, keyColumn, {key}, rows)) return;
+    for (const QSqlRecord &row : rows) {
+        Entry entry;
+        entry.kind = Insert;
+        entry.table = tableFor(table, row);
+        entry.after = recordValues(row);
+        append(entry);
+    }
+}
+
+int OperationJournal::recordDeleting(const QString &table, const QList<int> &keys)
+{
+    const QString keyColumn = primaryKey(table);
+    if (keyColumn.isEmpty()) {
+        m_error = "У таблицы " + table + " нет простого первичного ключа";
+        return -1;
+    }
+
+    QVector<QSqlRecord> rows;
+    if (!fetchRows(table, keyColumn, keys, rows)) {
+        return -1;
+    }
+    // Удаление пачкой пишется одной группой, даже если вызвано вне beginGroup()
+    beginGroup(QString("Удаление из %1 (%2)").arg(table).arg(rows.size()));
+    for (const QSqlRecord &row : rows) {
+        Entry entry;
+        entry.kind = Delete;
+        entry.table = tableFor(table, row);
+        entry.before = recordValues(row);
+        append(entry);
+    }
+    endGroup();
+    return rows.size();
+}
+
+void OperationJournal::recordUpdating(const QString &table, int key, const QSqlRecord &changes)
+{
+    const QString keyColumn = primaryKey(table);
+    if (keyColumn.isEmpty()) return;
+
+    QVector<QSqlRecord> rows;
+    if (!fetchRows(table, keyColumn, {key}, rows) || rows.isEmpty()) return;
+
+    Entry entry;
+    entry.kind = Update;
+    entry.table = tableFor(table, rows.first());
+    entry.before = recordValues(rows.first());
+    entry.after = entry.before;
+    const Table &info = m_tables.at(entry.table);
+    for (int i = 0; i < changes.count(); ++i) {
+        const int column = info.columns.indexOf(changes.fieldName(i));
+        if (changes.isGenerated(i) && column >= 0) {
+            entry.after[column] = changes.value(i);
+        }
+    }
+    if (entry.after != entry.before) {
+        m_pending.append(entry);
+    }
+}
+
+void OperationJournal::confirmUpdate(bool succeeded)
+{
+    if (succeeded) {
+        for (const Entry &entry : m_pending) {
+            append(entry);
+        }
+    }
+    m_pending.clear();
+}
+
+void OperationJournal::watchModel(QSqlTableModel *model)
+{
+    // Сигнал приходит до UPDATE: снимаем образ строки, пока она ещё не изменена,
+    // в журнал он попадёт после confirmUpdate(). Ключ берём из исходной выборки,
+    // а не из кэша правок модели.
+    connect(model, &QSqlTableModel::beforeUpdate, this, [this, model](int row, QSqlRecord &record) {
+        const QString keyColumn = primaryKey(model->tableName());
+        if (keyColumn.isEmpty()) return;
+        const QVariant key = model->QSqlQueryModel::record(row).value(keyColumn);
+        if (key.isValid()) {
+            recordUpdating(model->tableName(), key.toInt(), record);
+        }
+    });
+}
+
+bool OperationJournal::undo()
+{
+    if (!canUndo()) return false;
+
+    const Group group = m_undo.last();
+    if (!apply(group, true)) {
+        QMessageBox::warning(nullptr, "Ошибка", "Не удалось отменить операцию: " + m_error);
+        return false;
+    }
+    m_undo.removeLast();
+    m_redo.append(group);
+    writeMarker(TagUndone, group.id);
+    emit changed();
+    return true;
+}
+
+bool OperationJournal::redo()
+{
+    if (!canRedo()) return false;
+
+    const Group group = m_redo.last();
+    if (!apply(group, false)) {
+        QMessageBox::warning(nullptr, "Ошибка", "Не удалось повторить операцию: " + m_error);
+        return false;
+    }
+    m_redo.removeLast();
+    m_undo.append(group);
+    writeMarker(TagRedone, group.id);
+    emit changed();
+    return true;
+}
+
+int OperationJournal::tableFor(const QString &table, const QSqlRecord &record)
+{
+    auto it = m_tableIndex.constFind(table);
+    if (it != m_tableIndex.constEnd()) {
+        return it.value();
+    }
+
+    Table info;
+    info.name = table;
+    info.key = primaryKey(table);
+    for (int i = 0; i < record.count(); ++i) {
+        info.columns << record.fieldName(i);
+    }
+    info.keyIndex = info.columns.indexOf(info.key);
+    // Типы берём из описания таблицы: у выражений в выборке их может не быть
+    const QSqlRecord columns = m_db.record(table);
+    for (int i = 0; i < record.count(); ++i) {
+        const int column = columns.indexOf(record.fieldName(i));
+        info.marks << typedMark(column >= 0 ? columns.field(column) : record.field(i));
+    }
+    m_tables.append(info);
+    m_tableIndex.insert(table, m_tables.size() - 1);
+    return m_tables.size() - 1;
+}
+
+bool OperationJournal::fetchRows(const QString &table, const QString &key, const QList<int> &keys,
+                                 QVector<QSqlRecord> &rows)
+{
+    rows.clear();
+    rows.reserve(keys.size());
+    QSqlQuery query(m_db);
+    query.setForwardOnly(true);
+    const int keysPerStatement = qMin(MaxKeysPerStatement, m_maxBindValues);
+    for (int start = 0; start < keys.size(); start += keysPerStatement) {
+        const QList<int> chunk = keys.mid(start, keysPerStatement);
+        query.prepare(QString("SELECT * FROM %1 WHERE %2 IN %3").arg(table, key, placeholders(chunk.size())));
+        for (int value : chunk) {
+            query.addBindValue(value);
+        }
+        // Без полного набора образов операцию нельзя будет отменить целиком
+        if (!query.exec()) {
+            m_error = query.lastError().text();
+            qDebug() << "Ошибка чтения строк для журнала:" << m_error;
+            return false;
+        }
+        while (query.next()) {
+            rows.append(query.record());
+        }
+    }
+    return true;
+}
+
+void OperationJournal::append(const Entry &entry)
+{
+    if (m_depth > 0) {
+        m_current.entries.append(entry);
+        return;
+    }
+
+    static const char *labels[] = {"", "Добавление в ", "Удаление из ", "Изменение в "};
+    Group group;
+    group.label = labels[entry.kind] + m_tables.at(entry.table).name;
+    group.entries.append(entry);
+    push(group);
+}
+
+void OperationJournal::push(Group group)
+{
+    group.id = m_nextId++;
+    group.time = QDateTime::currentDateTime();
+    writeGroup(group);
+
+    m_undo.append(group);
+    if (m_undo.size() > MaxUndoGroups) {
+        m_undo.removeFirst();
+    }
+    m_redo.clear();
+    emit changed();
+}
+
+void OperationJournal::writeGroup(const Group &group)
+{
+    if (!m_file.isOpen()) return;
+
+    QDataStream out(&m_file);
+    out.setVersion(QDataStream::Qt_5_12);
+
+    // Описание таблицы (имена столбцов) пишется один раз за сеанс,
+    // записи строк ссылаются на него по индексу
+    for (const Entry &entry : group.entries) {
+        Table &table = m_tables[entry.table];
+        if (!table.written) {
+            out << TagTable << quint16(entry.table) << table.name << table.key << table.columns;
+            table.written = true;
+        }
+    }
+
+    out << TagGroup << group.id << group.time.toMSecsSinceEpoch() << group.label
+        << quint32(group.entries.size());
+    for (const Entry &entry : group.entries) {
+        out << quint8(entry.kind) << quint16(entry.table) << entry.before << entry.after;
+    }
+    m_file.flush();
+}
+
+void OperationJournal::writeMarker(quint8 tag, quint32 id)
+{
+    if (!m_file.isOpen()) return;
+
+    QDataStream out(&m_file);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << tag << id << QDateTime::currentMSecsSinceEpoch();
+    m_file.flush();
+}
+
+bool OperationJournal::apply(const Group &group, bool reverse)
+{
+    // Подряд идущие записи одного вида над одной таблицей выполняются одним запросом,
+    // порядок между разными таблицами сохраняется ради внешних ключей. Повтор ключа
+    // внутри серии (две правки одной строки) начинает новую серию.
+    enum Action { None, DeleteRows, InsertRows, UpdateRows };
+
+    if (!m_db.transaction()) {
+        m_error = m_db.lastError().text();
+        return false;
+    }
+
+    Action runAction = None;
+    int runTable = -1;
+    QSet<QString> runKeys;
+    QVector<QVariantList> runExpected;
+    QVector<QVariantList> runRows;
+
+    auto flush = [&]() {
+        bool ok = true;
+        if (runAction == DeleteRows) {
+            ok = execDelete(m_tables.at(runTable), runExpected);
+        } else if (runAction == InsertRows) {
+            ok = execInsert(m_tables.at(runTable), runRows);
+        } else if (runAction == UpdateRows) {
+            ok = execUpdate(m_tables.at(runTable), runExpected, runRows);
+        }
+        runKeys.clear();
+        runExpected.clear();
+        runRows.clear();
+        return ok;
+    };
+
+    bool ok = true;
+    const int count = group.entries.size();
+    for (int n = 0; n < count && ok; ++n) {
+        const Entry &entry = group.entries.at(reverse ? count - 1 - n : n);
+
+        // expected — каким строка должна быть в базе сейчас, row — какой она станет
+        Action action;
+        const QVariantList *expected = nullptr;
+        const QVariantList *row;
+        if (entry.kind == Update) {
+            action = UpdateRows;
+            expected = reverse ? &entry.after : &entry.before;
+            row = reverse ? &entry.before : &entry.after;
+        } else if ((entry.kind == Insert) == reverse) {
+            action = DeleteRows;
+            expected = reverse ? &entry.after : &entry.before;
+            row = expected;
+        } else {
+            action = InsertRows;
+            row = reverse ? &entry.before : &entry.after;
+        }
+
+        const QString key = row->at(m_tables.at(entry.table).keyIndex).toString();
+        if (action != runAction || entry.table != runTable || runKeys.contains(key)) {
+            ok = flush();
+            runAction = action;
+            runTable = entry.table;
+        }
+        runKeys.insert(key);
+        if (expected) {
+            runExpected << *expected;
+        }
+        if (action != DeleteRows) {
+            runRows << *row;
+        }
+    }
+    if (ok) {
+        ok = flush();
+    }
+
+    if (!ok) {
+        m_db.rollback();
+        return false;
+    }
+    if (!m_db.commit()) {
+        m_error = m_db.lastError().text();
+        m_db.rollback();
+        return false;
+    }
+    return true;
+}
+
+bool OperationJournal::execDelete(const Table &table, const QVector<QVariantList> &expected)
+{
+    // Удаляется только строка, совпадающая с образом из журнала целиком:
+    // изменённую другим пользователем строку молча не теряем
+    const int columns = table.columns.size();
+    const int rowsPerStatement = qMax(1, m_maxBindValues / qMax(1, columns));
+
+    QSqlQuery query(m_db);
+    for (int start = 0; start < expected.size(); start += rowsPerStatement) {
+        const int end = qMin(expected.size(), start + rowsPerStatement);
+        query.prepare(QString("WITH expected AS (%1) DELETE FROM %2 WHERE EXISTS "
+                              "(SELECT 1 FROM expected WHERE %3)")
+                      .arg(rowSet(table.name, table.columns, table.marks, end - start), table.name,
+                           sameRow(table.name, table.key, table.columns, "expected")));
+        for (int i = start; i < end; ++i) {
+            for (const QVariant &value : expected.at(i)) {
+                query.addBindValue(value);
+            }
+        }
+        if (!query.exec()) {
+            m_error = query.lastError().text();
+            return false;
+        }
+        if (!checkAffected(query, end - start)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool OperationJournal::execInsert(const Table &table, const QVector<QVariantList> &rows)
+{
+    // Строки возвращаются вместе с прежними ключами, поэтому ссылки на них остаются верными
+    const int columns = table.columns.size();
+    const int rowsPerStatement = qMax(1, m_maxBindValues / qMax(1, columns));
+    const QString rowMarks = placeholders(columns);
+
+    QSqlQuery query(m_db);
+    for (int start = 0; start < rows.size(); start += rowsPerStatement) {
+        const int end = qMin(rows.size(), start + rowsPerStatement);
+        QStringList values;
+        for (int i = start; i < end; ++i) {
+            values << rowMarks;
+        }
+        query.prepare(QString("INSERT INTO %1 (%2) VALUES %3")
+                      .arg(table.name, table.columns.join(", "), values.join(", ")));
+        for (int i = start; i < end; ++i) {
+            for (const QVariant &value : rows.at(i)) {
+                query.addBindValue(value);
+            }
+        }
+        if (!query.exec()) {
+            m_error = query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool OperationJournal::execUpdate(const Table &table, const QVector<QVariantList> &expected,
+                                  const QVector<QVariantList> &rows)
+{
+    // Одна команда на пачку строк: прежние и новые образы передаются наборами
+    // VALUES. execBatch() здесь не годится — QPSQL и QSQLITE эмулируют его
+    // отдельным запросом на каждую строку
+    const int columns = table.columns.size();
+    const int rowsPerStatement = qMax(1, m_maxBindValues / qMax(1, 2 * columns));
+    const QString key = table.key;
+
+    QSqlQuery query(m_db);
+    for (int start = 0; start < rows.size(); start += rowsPerStatement) {
+        const int end = qMin(rows.size(), start + rowsPerStatement);
+        const int count = end - start;
+
+        QStringList assignments;
+        for (int column = 0; column < columns; ++column) {
+            if (column == table.keyIndex) continue;
+            const QString name = table.columns.at(column);
+            assignments << (m_updateFrom
+                            ? QString("%1 = next_rows.%1").arg(name)
+                            : QString("%1 = (SELECT next_rows.%1 FROM next_rows WHERE next_rows.%2 = %3.%2)")
+                                  .arg(name, key, table.name));
+        }
+        const QString with = QString("WITH prev_rows AS (%1), next_rows AS (%2) ")
+                             .arg(rowSet(table.name, table.columns, table.marks, count),
+                                  rowSet(table.name, table.columns, table.marks, count));
+        const QString match = sameRow(table.name, key, table.columns, "prev_rows");
+        if (m_updateFrom) {
+            query.prepare(with + QString("UPDATE %1 SET %2 FROM prev_rows, next_rows "
+                                         "WHERE next_rows.%3 = prev_rows.%3 AND %4")
+                          .arg(table.name, assignments.join(", "), key, match));
+        } else {
+            query.prepare(with + QString("UPDATE %1 SET %2 WHERE EXISTS (SELECT 1 FROM prev_rows WHERE %3)")
+                          .arg(table.name, assignments.join(", "), match));
+        }
+
+        for (int i = start; i < end; ++i) {
+            for (const QVariant &value : expected.at(i)) {
+                query.addBindValue(value);
+            }
+        }
+        for (int i = start; i < end; ++i) {
+            for (const QVariant &value : rows.at(i)) {
+                query.addBindValue(value);
+            }
+        }
+        if (!query.exec()) {
+            m_error = query.lastError().text();
+            return false;
+        }
+        if (!checkAffected(query, count)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool OperationJournal::checkAffected(const QSqlQuery &query, int rows)
+{
+    // Меньше строк, чем в журнале: часть из них уже изменена или удалена
+    // другим пользователем, вся группа откатывается
+    const int affected = query.numRowsAffected();
+    if (affected != rows) {
+        m_error = QString("%1 из %2 строк уже изменены или удалены другим пользователем")
+                  .arg(rows - qMax(0, affected)).arg(rows);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,144 @@
+#ifndef OPERATIONJOURNAL_H
+#define OPERATIONJOURNAL_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QSqlDatabase>
+#include <QSqlRecord>
+#include <QSqlTableModel>
+#include <QVariant>
+#include <QVector>
+
+// Журнал операций над таблицами: хранит образы строк до и после изменения,
+// объединяет их в группы и умеет откатывать/повторять группу одной транзакцией.
+// Каждая завершённая группа дописывается в бинарный файл журнала.
+class OperationJournal : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Kind : quint8 { Insert = 1, Delete = 2, Update = 3 };
+
+    struct Entry {
+        Kind kind = Insert;
+        int table = 0;       // индекс в m_tables
+        QVariantList before; // пусто для Insert
+        QVariantList after;  // пусто для Delete
+    };
+
+    struct Group {
+        quint32 id = 0;
+        QString label;
+        QDateTime time;
+        QVector<Entry> entries;
+    };
+
+    explicit OperationJournal(const QSqlDatabase &db, QObject *parent = nullptr);
+    ~OperationJournal();
+
+    bool open(const QString &fileName);
+
+    // Группы могут вкладываться; запись вне группы образует отдельную группу
+    void beginGroup(const QString &label);
+    void endGroup();
+    void abortGroup();
+
+    QString primaryKey(const QString &table);
+
+    // Вызывать после INSERT: образ строки читается из базы
+    void recordInserted(const QString &table, int key);
+    // Вызывать до DELETE в той же транзакции. Возвращает число снятых образов
+    // (столько строк DELETE и должен удалить) или -1 при ошибке
+    int recordDeleting(const QString &table, const QList<int> &keys);
+    // Вызывать до UPDATE: changes содержит новые значения изменённых полей.
+    // Запись попадает в журнал только после confirmUpdate(true)
+    void recordUpdating(const QString &table, int key, const QSqlRecord &changes);
+    void confirmUpdate(bool succeeded);
+
+    void watchModel(QSqlTableModel *model);
+
+    bool canUndo() const { return !m_undo.isEmpty(); }
+    bool canRedo() const { return !m_redo.isEmpty(); }
+    QString undoLabel() const { return canUndo() ? m_undo.last().label : QString(); }
+    QString redoLabel() const { return canRedo() ? m_redo.last().label : QString(); }
+
+    bool undo();
+    bool redo();
+    QString lastError() const { return m_error; }
+
+    void setMaxBindValues(int count) { m_maxBindValues = qMax(1, count); }
+    // UPDATE ... FROM (PostgreSQL, SQLite 3.33+); без него новые значения
+    // берутся подзапросами
+    void setUpdateFromSupported(bool supported) { m_updateFrom = supported; }
+
+signals:
+    void changed();
+
+private:
+    struct Table {
+        QString name;
+        QString key;
+        QStringList columns;
+        QStringList marks;   // параметры с приведением к типам столбцов
+        int keyIndex = 0;
+        bool written = false; // описание уже есть в файле журнала
+    };
+
+    QSqlDatabase m_db;
+    QFile m_file;
+    QVector<Table> m_tables;
+    QHash<QString, int> m_tableIndex;
+    QHash<QString, QString> m_keys;
+    QVector<Group> m_undo;
+    QVector<Group> m_redo;
+    Group m_current;
+    QVector<Entry> m_pending;  // образы строк, чей UPDATE ещё не выполнен
+    int m_depth;
+    quint32 m_nextId;
+    int m_maxBindValues;
+    bool m_updateFrom;
+    QString m_error;
+
+    int tableFor(const QString &table, const QSqlRecord &record);
+    bool fetchRows(const QString &table, const QString &key, const QList<int> &keys, QVector<QSqlRecord> &rows);
+    void append(const Entry &entry);
+    void push(Group group);
+    void writeGroup(const Group &group);
+    void writeMarker(quint8 tag, quint32 id);
+
+    bool apply(const Group &group, bool reverse);
+    bool execDelete(const Table &table, const QVector<QVariantList> &expected);
+    bool execInsert(const Table &table, const QVector<QVariantList> &rows);
+    bool execUpdate(const Table &table, const QVector<QVariantList> &expected, const QVector<QVariantList> &rows);
+    bool checkAffected(const QSqlQuery &query, int rows);
+};
+
+// Модель, у которой правка строки попадает в журнал только после успешного
+// UPDATE: сигнал beforeUpdate приходит раньше, и неудачная запись оставила бы
+// в истории отмены группу, которой в базе нет
+template<typename Model>
+class JournaledModel : public Model
+{
+public:
+    JournaledModel(OperationJournal *journal, QObject *parent, const QSqlDatabase &db)
+        : Model(parent, db)
+        , m_journal(journal)
+    {
+        m_journal->watchModel(this);
+    }
+
+protected:
+    bool updateRowInTable(int row, const QSqlRecord &values) override
+    {
+        const bool ok = Model::updateRowInTable(row, values);
+        m_journal->confirmUpdate(ok);
+        return ok;
+    }
+
+private:
+    OperationJournal *m_journal;
+};
+
+#endif // OPERATIONJOURNAL_H
@@ -0,0 +1,159 @@
+#include "postgresbackend.h"
+#include <QSqlError>
+#include <QDebug>
+
+namespace {
+
+const char *ChangeChannel = "table_changed";
+const QStringList ChangeTables = {"authors", "genres", "publishers", "readers", "books", "issues"};
+
+bool exists(QSqlQuery &query, const QString &sql)
+{
+    return query.exec(sql) && query.next();
+}
+
+} // namespace
+
+void PostgresBackend::configure(QSqlDatabase &db) const
+{
+    db.setDatabaseName("biblioteka");
+    db.setUserName("postgres");
+    db.setHostName("localhost");
+    db.setPort(5432);
+    // connect_timeout ограничивает open(), keepalive обнаруживает оборванный канал
+    // за ~10 секунд вместо системных двух часов. Пока отправленные данные не
+    // подтверждены, keepalive не работает: запрос к молча оборванному каналу
+    // ограничивает tcp_user_timeout (мс, libpq 12+)
+    db.setConnectOptions("connect_timeout=3;keepalives=1;keepalives_idle=5;keepalives_interval=2;keepalives_count=2;"
+                         "tcp_user_timeout=10000");
+}
+
+bool PostgresBackend::initSession(QSqlDatabase &)
+{
+    return true;
+}
+
+bool PostgresBackend::createSchema(QSqlDatabase &db)
+{
+    QSqlQuery query(db);
+    if (!execAll(query, {
+        "CREATE TABLE IF NOT EXISTS authors ("
+        "author_id SERIAL PRIMARY KEY, "
+        "name VARCHAR(255) NOT NULL)",
+
+        "CREATE TABLE IF NOT EXISTS genres ("
+        "genre_id SERIAL PRIMARY KEY, "
+        "name VARCHAR(255) NOT NULL)",
+
+        "CREATE TABLE IF NOT EXISTS publishers ("
+        "publisher_id SERIAL PRIMARY KEY, "
+        "name VARCHAR(255) NOT NULL)",
+
+        "CREATE TABLE IF NOT EXISTS readers ("
+        "reader_id SERIAL PRIMARY KEY, "
+        "name VARCHAR(255) NOT NULL, "
+        "email VARCHAR(255))",
+
+        "CREATE TABLE IF NOT EXISTS books ("
+        "book_id SERIAL PRIMARY KEY, "
+        "title VARCHAR(255) NOT NULL, "
+        "author_id INTEGER REFERENCES authors(author_id), "
+        "genre_id INTEGER REFERENCES genres(genre_id), "
+        "publisher_id INTEGER REFERENCES publishers(publisher_id), "
+        "publish_year INTEGER, "
+        "total_copies INTEGER DEFAULT 1)",
+
+        "CREATE TABLE IF NOT EXISTS issues ("
+        "issue_id SERIAL PRIMARY KEY, "
+        "book_id INTEGER REFERENCES books(book_id), "
+        "reader_id INTEGER REFERENCES readers(reader_id), "
+        "issue_date DATE NOT NULL DEFAULT CURRENT_DATE, "
+        "return_date DATE)",
+
+        // Индекс для отчётов по периодам и просрочкам
+        "CREATE INDEX IF NOT EXISTS issues_issue_date_idx ON issues (issue_date)"
+    })) {
+        return false;
+    }
+
+    // Без триггеров приложение работает, только не узнаёт о чужих изменениях
+    if (!createChangeTriggers(db)) {
+        qDebug() << "Не удалось создать триггеры уведомлений об изменениях";
+    }
+    return true;
+}
+
+QString PostgresBackend::searchFilter(const QString &, const QStringList &columns, const QString &text) const
+{
+    if (columns.isEmpty()) {
+        return QString();
+    }
+    // Начало слова — начало строки или небуквенный символ перед ним; слова
+    // состоят только из букв и цифр, экранировать в них нечего
+    QStringList conditions;
+    for (const QString &word : searchWords(text)) {
+        const QString pattern = quoted("(^|[^[:alnum:]])" + word);
+        QStringList alternatives;
+        for (const QString &column : columns) {
+            alternatives << column + " ~* " + pattern;
+        }
+        conditions << "(" + alternatives.join(" OR ") + ")";
+    }
+    return conditions.join(" AND ");
+}
+
+QString PostgresBackend::dateLiteral(const QDate &date) const
+{
+    return quoted(date.toString(Qt::ISODate)) + "::date";
+}
+
+bool PostgresBackend::createChangeTriggers(QSqlDatabase &db)
+{
+    // Один канал на все таблицы, имя таблицы передаётся в payload.
+    // Триггер срабатывает на оператор, а не на строку, поэтому пакетные
+    // операции порождают одно уведомление.
+    // Объекты создаются, только если их ещё нет: пересоздание при каждом запуске
+    // брало бы блокировки общих таблиц и требовало прав владельца. Если другой
+    // клиент успел создать объект одновременно с нами, CREATE упадёт, но
+    // повторная проверка найдёт готовый объект
+    QSqlQuery query(db);
+    const QString functionExists = "SELECT 1 FROM pg_proc WHERE proname = 'practics_notify_change'";
+    if (!exists(query, functionExists)) {
+        const QString create = QString("CREATE FUNCTION practics_notify_change() RETURNS trigger AS $$ "
+                                       "BEGIN PERFORM pg_notify('%1', TG_TABLE_NAME); RETURN NULL; END "
+                                       "$$ LANGUAGE plpgsql").arg(ChangeChannel);
+        if (!query.exec(create) && !exists(query, functionExists)) {
+            qDebug() << "Ошибка создания функции уведомлений:" << query.lastError().text();
+            return false;
+        }
+    }
+
+    for (const QString &table : ChangeTables) {
+        const QString triggerExists = QString("SELECT 1 FROM pg_trigger WHERE tgname = '%1_notify_change' "
+                                              "AND tgrelid = '%1'::regclass").arg(table);
+        if (exists(query, triggerExists)) continue;
+
+        const QString create = QString("CREATE TRIGGER %1_notify_change AFTER INSERT OR UPDATE OR DELETE ON %1 "
+                                       "FOR EACH STATEMENT EXECUTE PROCEDURE practics_notify_change()").arg(table);
+        if (!query.exec(create) && !exists(query, triggerExists)) {
+            qDebug() << "Ошибка создания триггера для" << table << ":" << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+QStringList PostgresBackend::notificationChannels(const QStringList &) const
+{
+    return {ChangeChannel};
+}
+
+QString PostgresBackend::changedTable(const QString &, const QVariant &payload) const
+{
+    return payload.toString();
+}
+
+bool PostgresBackend::isExternalChange(QSqlDriver::NotificationSource source) const
+{
+    return source == QSqlDriver::OtherSource;
+}
@@ -0,0 +1,34 @@
+#ifndef POSTGRESBACKEND_H
+#define POSTGRESBACKEND_H
+
+#include "sqlbackend.h"
+
+class PostgresBackend : public SqlBackend
+{
+public:
+    QString name() const override { return "postgres"; }
+    QString driverName() const override { return "QPSQL"; }
+    bool isEmbedded() const override { return false; }
+
+    void configure(QSqlDatabase &db) const override;
+    bool initSession(QSqlDatabase &db) override;
+    bool createSchema(QSqlDatabase &db) override;
+
+    QString searchFilter(const QString &table, const QStringList &columns, const QString &text) const override;
+    QString dateLiteral(const QDate &date) const override;
+
+    bool hasServerCursors() const override { return true; }
+    bool supportsReturning() const override { return true; }
+    // PostgreSQL допускает не больше 65535 параметров в одном запросе
+    int maxBindValues() const override { return 30000; }
+    bool supportsUpdateFrom() const override { return true; }
+
+    QStringList notificationChannels(const QStringList &tables) const override;
+    QString changedTable(const QString &channel, const QVariant &payload) const override;
+    bool isExternalChange(QSqlDriver::NotificationSource source) const override;
+
+private:
+    bool createChangeTriggers(QSqlDatabase &db);
+};
+
+#endif // POSTGRESBACKEND_H
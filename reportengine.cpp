@@ -0,0 +1,333 @@
+#include "reportengine.h"
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QFuture>
+#include <QList>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <algorithm>
+
+namespace {
+
+const int BatchSize = 5000;
+
+// Выборка истории выдач вместе с названием книги и именем читателя
+const char *IssuesSelect =
+    "SELECT i.issue_id, i.book_id, i.reader_id, b.title, r.name, i.issue_date, i.return_date "
+    "FROM issues i "
+    "LEFT JOIN books b ON b.book_id = i.book_id "
+    "LEFT JOIN readers r ON r.reader_id = i.reader_id ";
+
+QString csvCell(QString value)
+{
+    if (value.contains(';') || value.contains('"') || value.contains('\n')) {
+        value.replace("\"", "\"\"");
+        return "\"" + value + "\"";
+    }
+    return value;
+}
+
+ActivityStats aggregateBatch(const QVector<IssueRow> &batch, const QDate &today, int loanDays)
+{
+    ActivityStats stats;
+    for (const IssueRow &row : batch) {
+        ActivityStats::Reader &reader = stats.readers[row.readerId];
+        if (reader.name.isEmpty()) {
+            reader.name = row.readerName;
+        }
+        reader.issued++;
+
+        const QDate dueDate = row.issueDate.addDays(loanDays);
+        if (row.returnDate.isValid()) {
+            reader.returned++;
+            if (row.returnDate > dueDate) {
+                reader.returnedLate++;
+            }
+        } else if (dueDate < today) {
+            reader.overdue++;
+        }
+
+        stats.months[QDate(row.issueDate.year(), row.issueDate.month(), 1)]++;
+    }
+    return stats;
+}
+
+} // namespace
+
+void ActivityStats::merge(const ActivityStats &other)
+{
+    for (auto it = other.readers.cbegin(); it != other.readers.cend(); ++it) {
+        Reader &reader = readers[it.key()];
+        if (reader.name.isEmpty()) {
+            reader.name = it->name;
+        }
+        reader.issued += it->issued;
+        reader.returned += it->returned;
+        reader.returnedLate += it->returnedLate;
+        reader.overdue += it->overdue;
+    }
+    for (auto it = other.months.cbegin(); it != other.months.cend(); ++it) {
+        months[it.key()] += it.value();
+    }
+}
+
+ReportEngine::ReportEngine(Database *db, QObject *parent)
+    : QObject(parent)
+    , m_db(db)
+    , m_format(Html)
+{
+}
+
+ReportEngine::Format ReportEngine::formatForFile(const QString &fileName)
+{
+    return QFileInfo(fileName).suffix().compare("csv", Qt::CaseInsensitive) == 0 ? Csv : Html;
+}
+
+template<typename Handler>
+bool ReportEngine::streamIssues(const QString &select, Handler handleBatch)
+{
+    // QPSQL забирает весь результат запроса в память клиента, поэтому
+    // историю читаем через серверный курсор пачками по BatchSize строк.
+    // SQLite и так отдаёт строки по одной, там достаточно однонаправленного запроса
+    const bool useCursor = m_db->backend()->hasServerCursors();
+    // Соединение читается в обход ConnectionSupervisor::run(), поэтому об
+    // ошибках сообщаем ему сами: обрыв связи запустит переподключение
+    QSqlDatabase db = m_db->database();
+    if (!db.transaction()) {
+        QMessageBox::warning(nullptr, "Ошибка", "Не удалось начать транзакцию: " + db.lastError().text());
+        m_db->supervisor()->reportFailure();
+        return false;
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec(useCursor ? "DECLARE issues_report NO SCROLL CURSOR FOR " + select : select)) {
+        QMessageBox::warning(nullptr, "Ошибка", "Не удалось выполнить запрос отчёта: " + query.lastError().text());
+        db.rollback();
+        m_db->supervisor()->reportFailure();
+        return false;
+    }
+
+    const QString fetch = QString("FETCH FORWARD %1 FROM issues_report").arg(BatchSize);
+    int processed = 0;
+    bool ok = true;
+    forever {
+        if (useCursor && !query.exec(fetch)) {
+            QMessageBox::warning(nullptr, "Ошибка", "Не удалось прочитать данные отчёта: " + query.lastError().text());
+            // Отчёт не повторяется сам: его длинная выборка должна идти целиком
+            // в одном сеансе, пользователь запустит его после восстановления связи
+            m_db->supervisor()->reportFailure();
+            ok = false;
+            break;
+        }
+
+        QVector<IssueRow> batch;
+        batch.reserve(BatchSize);
+        while (batch.size() < BatchSize && query.next()) {
+            IssueRow row;
+            row.issueId = query.value(0).toInt();
+            row.bookId = query.value(1).toInt();
+            row.readerId = query.value(2).toInt();
+            row.title = query.value(3).toString();
+            row.readerName = query.value(4).toString();
+            row.issueDate = query.value(5).toDate();
+            row.returnDate = query.value(6).toDate();
+            batch.append(row);
+        }
+        if (batch.isEmpty()) {
+            break;
+        }
+
+        processed += batch.size();
+        handleBatch(std::move(batch));
+        emit progress(processed);
+        // Не блокируем интерфейс на длинных отчётах
+        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+    }
+
+    if (useCursor) {
+        query.exec("CLOSE issues_report");
+    } else {
+        query.finish();
+    }
+    // Отчёт только читает, откат дешевле и ничего не теряет
+    db.rollback();
+    return ok;
+}
+
+bool ReportEngine::writeOverdueReport(const QString &fileName, const QDate &asOf, int loanDays)
+{
+    QFile file(fileName);
+    QTextStream out;
+    if (!openReport(file, out, fileName, "Просроченные выдачи на " + asOf.toString("dd.MM.yyyy"))) {
+        return false;
+    }
+    beginTable(out, QString(), {"ID выдачи", "Читатель", "Книга", "Дата выдачи", "Срок возврата", "Дней просрочки"});
+
+    // Отбор просрочек делает сервер, клиенту остаётся только записать строки
+    const QDate cutoff = asOf.addDays(-loanDays);
+    const QString select = QString(IssuesSelect)
+        + QString("WHERE i.return_date IS NULL AND i.issue_date < %1 ORDER BY i.issue_date, i.issue_id")
+              .arg(m_db->backend()->dateLiteral(cutoff));
+
+    const bool ok = streamIssues(select, [&](QVector<IssueRow> batch) {
+        for (const IssueRow &row : batch) {
+            const QDate dueDate = row.issueDate.addDays(loanDays);
+            writeRow(out, {QString::number(row.issueId),
+                           row.readerName,
+                           row.title,
+                           row.issueDate.toString("dd.MM.yyyy"),
+                           dueDate.toString("dd.MM.yyyy"),
+                           QString::number(dueDate.daysTo(asOf))});
+        }
+    });
+
+    endTable(out);
+    closeReport(out);
+    return ok;
+}
+
+bool ReportEngine::writeActivityReport(const QString &fileName, const QDate &from, const QDate &to, int loanDays)
+{
+    // Пачки агрегируются в пуле потоков; чтобы память не росла вместе с историей,
+    // в работе держим не больше двух пачек на поток
+    const QDate today = QDate::currentDate();
+    const int maxPending = qMax(1, QThreadPool::globalInstance()->maxThreadCount()) * 2;
+    QList<QFuture<ActivityStats>> pending;
+    ActivityStats total;
+
+    const QString select = QString(IssuesSelect)
+        + QString("WHERE i.issue_date BETWEEN %1 AND %2").arg(m_db->backend()->dateLiteral(from), m_db->backend()->dateLiteral(to));
+
+    const bool ok = streamIssues(select, [&](QVector<IssueRow> batch) {
+        pending.append(QtConcurrent::run([batch = std::move(batch), today, loanDays]() {
+            return aggregateBatch(batch, today, loanDays);
+        }));
+        if (pending.size() >= maxPending) {
+            total.merge(pending.takeFirst().result());
+        }
+    });
+    while (!pending.isEmpty()) {
+        total.merge(pending.takeFirst().result());
+    }
+    if (!ok) {
+        return false;
+    }
+
+    QFile file(fileName);
+    QTextStream out;
+    const QString period = from.toString("dd.MM.yyyy") + " - " + to.toString("dd.MM.yyyy");
+    if (!openReport(file, out, fileName, "Активность читателей за " + period)) {
+        return false;
+    }
+
+    const QList<int> keys = total.readers.keys();
+    QVector<int> readerIds(keys.cbegin(), keys.cend());
+    std::sort(readerIds.begin(), readerIds.end(), [&](int a, int b) {
+        const ActivityStats::Reader &ra = total.readers[a];
+        const ActivityStats::Reader &rb = total.readers[b];
+        return ra.issued != rb.issued ? ra.issued > rb.issued : ra.name < rb.name;
+    });
+
+    beginTable(out, "По читателям", {"ID читателя", "Читатель", "Выдано", "Возвращено", "Возвращено с опозданием", "Просрочено"});
+    for (int readerId : readerIds) {
+        const ActivityStats::Reader &reader = total.readers[readerId];
+        writeRow(out, {QString::number(readerId),
+                       reader.name,
+                       QString::number(reader.issued),
+                       QString::number(reader.returned),
+                       QString::number(reader.returnedLate),
+                       QString::number(reader.overdue)});
+    }
+    endTable(out);
+
+    beginTable(out, "По месяцам", {"Месяц", "Выдано"});
+    for (auto it = total.months.cbegin(); it != total.months.cend(); ++it) {
+        writeRow(out, {it.key().toString("MM.yyyy"), QString::number(it.value())});
+    }
+    endTable(out);
+
+    closeReport(out);
+    return true;
+}
+
+bool ReportEngine::openReport(QFile &file, QTextStream &out, const QString &fileName, const QString &title)
+{
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        QMessageBox::warning(nullptr, "Ошибка", "Не удалось открыть файл отчёта: " + file.errorString());
+        return false;
+    }
+
+    m_format = formatForFile(fileName);
+    out.setDevice(&file);
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+    out.setCodec("UTF-8");
+#endif
+
+    if (m_format == Csv) {
+        // BOM нужен, чтобы Excel распознал кириллицу
+        out.setGenerateByteOrderMark(true);
+        out << csvCell(title) << "\n";
+    } else {
+        out << "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n"
+            << "<title>" << title.toHtmlEscaped() << "</title>\n</head>\n<body>\n"
+            << "<h1>" << title.toHtmlEscaped() << "</h1>\n";
+    }
+    return true;
+}
+
+void ReportEngine::closeReport(QTextStream &out)
+{
+    if (m_format == Html) {
+        out << "</body>\n</html>\n";
+    }
+    out.flush();
+}
+
+void ReportEngine::beginTable(QTextStream &out, const QString &caption, const QStringList &columns)
+{
+    if (m_format == Csv) {
+        out << "\n";
+        if (!caption.isEmpty()) {
+            out << csvCell(caption) << "\n";
+        }
+        QStringList cells;
+        for (const QString &column : columns) {
+            cells << csvCell(column);
+        }
+        out << cells.join(';') << "\n";
+    } else {
+        if (!caption.isEmpty()) {
+            out << "<h2>" << caption.toHtmlEscaped() << "</h2>\n";
+        }
+        out << "<table border=\"1\" cellspacing=\"0\" cellpadding=\"4\">\n<tr>";
+        for (const QString &column : columns) {
+            out << "<th>" << column.toHtmlEscaped() << "</th>";
+        }
+        out << "</tr>\n";
+    }
+}
+
+void ReportEngine::writeRow(QTextStream &out, const QStringList &cells)
+{
+    if (m_format == Csv) {
+        QStringList escaped;
+        for (const QString &cell : cells) {
+            escaped << csvCell(cell);
+        }
+        out << escaped.join(';') << "\n";
+    } else {
+        out << "<tr>";
+        for (const QString &cell : cells) {
+            out << "<td>" << cell.toHtmlEscaped() << "</td>";
+        }
+        out << "</tr>\n";
+    }
+}
+
+void ReportEngine::endTable(QTextStream &out)
+{
+    if (m_format == Html) {
+        out << "</table>\n";
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef REPORTENGINE_H
+#define REPORTENGINE_H
+
+#include <QObject>
+#include <QDate>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QTextStream>
+#include <QVector>
+#include "database.h"
+
+// Строка истории выдач в том виде, в котором она приходит из курсора
+struct IssueRow
+{
+    int issueId = 0;
+    int bookId = 0;
+    int readerId = 0;
+    QString title;
+    QString readerName;
+    QDate issueDate;
+    QDate returnDate;
+};
+
+// Частичные агрегаты по одной пачке строк; сливаются после обработки всех пачек
+struct ActivityStats
+{
+    struct Reader {
+        QString name;
+        int issued = 0;
+        int returned = 0;
+        int returnedLate = 0;
+        int overdue = 0;
+    };
+
+    QHash<int, Reader> readers;
+    QMap<QDate, int> months; // первое число месяца -> количество выдач
+
+    void merge(const ActivityStats &other);
+};
+
+class ReportEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Format { Html, Csv };
+    enum { DefaultLoanDays = 14 };
+
+    explicit ReportEngine(Database *db, QObject *parent = nullptr);
+
+    // Формат выбирается по расширению файла: .csv -> Csv, иначе Html
+    static Format formatForFile(const QString &fileName);
+
+    bool writeOverdueReport(const QString &fileName, const QDate &asOf, int loanDays);
+    bool writeActivityReport(const QString &fileName, const QDate &from, const QDate &to, int loanDays);
+
+signals:
+    // После каждой пачки строк истории выдач
+    void progress(int rowsProcessed);
+
+private:
+    Database *m_db;
+    Format m_format;
+
+    template<typename Handler>
+    bool streamIssues(const QString &select, Handler handleBatch);
+
+    bool openReport(QFile &file, QTextStream &out, const QString &fileName, const QString &title);
+    void closeReport(QTextStream &out);
+    void beginTable(QTextStream &out, const QString &caption, const QStringList &columns);
+    void writeRow(QTextStream &out, const QStringList &cells);
+    void endTable(QTextStream &out);
+};
+
+#endif // REPORTENGINE_H
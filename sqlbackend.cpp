@@ -0,0 +1,80 @@
+#include "sqlbackend.h"
+#include "postgresbackend.h"
+#include "sqlitebackend.h"
+#include <QSettings>
+#include <QSqlError>
+#include <QDebug>
+
+QString SqlBackend::configuredName()
+{
+    QString name = qEnvironmentVariable("PRACTICS_BACKEND");
+    if (name.isEmpty()) {
+        QSettings settings("Practics", "Practics");
+        name = settings.value("database/backend", "postgres").toString();
+    }
+    return name.toLower();
+}
+
+SqlBackend* SqlBackend::create(const QString &name)
+{
+    if (name == "sqlite") {
+        return new SqliteBackend();
+    }
+    if (name != "postgres") {
+        qDebug() << "Неизвестный тип базы данных" << name << ", используется PostgreSQL";
+    }
+    return new PostgresBackend();
+}
+
+QStringList SqlBackend::searchWords(const QString &text)
+{
+    QStringList words;
+    QString word;
+    for (const QChar &ch : text) {
+        if (ch.isLetterOrNumber()) {
+            word += ch;
+        } else if (!word.isEmpty()) {
+            words << word;
+            word.clear();
+        }
+    }
+    if (!word.isEmpty()) {
+        words << word;
+    }
+    return words;
+}
+
+bool SqlBackend::isSearchRefinement(const QStringList &previous, const QStringList &words)
+{
+    // Пустой прежний запрос отбирал все строки, любой новый запрос его уточняет
+    // Слово, начинающееся с нового слова, начинается и с прежнего, если прежнее
+    // слово — начало нового
+    for (const QString &oldWord : previous) {
+        const QString folded = oldWord.toCaseFolded();
+        bool covered = false;
+        for (const QString &newWord : words) {
+            if (newWord.toCaseFolded().startsWith(folded)) {
+                covered = true;
+                break;
+            }
+        }
+        if (!covered) return false;
+    }
+    return true;
+}
+
+bool SqlBackend::execAll(QSqlQuery &query, const QStringList &statements)
+{
+    for (const QString &statement : statements) {
+        if (!query.exec(statement)) {
+            qDebug() << "Ошибка выполнения" << statement.left(60) << ":" << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+QString SqlBackend::quoted(QString text)
+{
+    return "'" + text.replace("'", "''") + "'";
+}
@@ -0,0 +1,60 @@
+#ifndef SQLBACKEND_H
+#define SQLBACKEND_H
+
+#include <QDate>
+#include <QSqlDatabase>
+#include <QSqlDriver>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QVariant>
+
+// Диалектная часть Database: параметры подключения, схема, поиск, пакетные
+// операции и уведомления об изменениях для конкретного сервера СУБД
+class SqlBackend
+{
+public:
+    virtual ~SqlBackend() = default;
+
+    // Имя берётся из переменной окружения PRACTICS_BACKEND или из настроек
+    // (database/backend); по умолчанию "postgres"
+    static QString configuredName();
+    static SqlBackend* create(const QString &name);
+
+    virtual QString name() const = 0;
+    virtual QString driverName() const = 0;
+    // Встроенная база в файле: нет сервера, за соединением следить не нужно
+    virtual bool isEmbedded() const = 0;
+
+    virtual void configure(QSqlDatabase &db) const = 0;
+    virtual bool initSession(QSqlDatabase &db) = 0;
+    virtual bool createSchema(QSqlDatabase &db) = 0;
+
+    // Поиск: каждое слово запроса должно быть началом какого-то слова в одном из
+    // столбцов columns, без учёта регистра. Словом считается последовательность
+    // букв и цифр. Условие сервера может отбирать и лишние строки (окончательный
+    // отбор делает ClientQueryModel), но не должно терять подходящие
+    static QStringList searchWords(const QString &text);
+    virtual QString searchFilter(const QString &table, const QStringList &columns, const QString &text) const = 0;
+    // Строки нового запроса (слов words) — подмножество строк прежнего, значит
+    // его можно выполнить по уже отобранным строкам. Пустой прежний запрос
+    // отбирает все строки, поэтому любой запрос его уточняет
+    static bool isSearchRefinement(const QStringList &previous, const QStringList &words);
+    virtual QString dateLiteral(const QDate &date) const = 0;
+
+    virtual bool hasServerCursors() const = 0;
+    virtual bool supportsReturning() const = 0;
+    virtual int maxBindValues() const = 0;
+    // UPDATE ... FROM: пакетное обновление строк одним запросом
+    virtual bool supportsUpdateFrom() const = 0;
+
+    // Пустой список: уведомления об изменениях не нужны
+    virtual QStringList notificationChannels(const QStringList &tables) const = 0;
+    virtual QString changedTable(const QString &channel, const QVariant &payload) const = 0;
+    virtual bool isExternalChange(QSqlDriver::NotificationSource source) const = 0;
+
+protected:
+    static bool execAll(QSqlQuery &query, const QStringList &statements);
+    static QString quoted(QString text);
+};
+
+#endif // SQLBACKEND_H
@@ -0,0 +1,177 @@
+#include "sqlitebackend.h"
+#include <QDir>
+#include <QStandardPaths>
+#include <QVersionNumber>
+#include <QSqlError>
+#include <QDebug>
+
+SqliteBackend::SqliteBackend()
+    : m_hasFts(false)
+    , m_hasUpdateFrom(false)
+{
+}
+
+QString SqliteBackend::databasePath()
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dir);
+    return dir + "/biblioteka.sqlite";
+}
+
+void SqliteBackend::configure(QSqlDatabase &db) const
+{
+    db.setDatabaseName(databasePath());
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+}
+
+bool SqliteBackend::initSession(QSqlDatabase &db)
+{
+    // WAL: чтение не блокируется записью и фиксация дешевле;
+    // при WAL synchronous=NORMAL не грозит повреждением файла.
+    // mmap убирает копирование страниц через read() на больших выборках
+    QSqlQuery query(db);
+    if (query.exec("SELECT sqlite_version()") && query.next()) {
+        m_hasUpdateFrom = QVersionNumber::fromString(query.value(0).toString()) >= QVersionNumber(3, 33);
+    }
+    return execAll(query, {
+        "PRAGMA journal_mode = WAL",
+        "PRAGMA synchronous = NORMAL",
+        "PRAGMA mmap_size = 268435456",
+        "PRAGMA cache_size = -65536",
+        "PRAGMA temp_store = MEMORY",
+        "PRAGMA foreign_keys = ON"
+    });
+}
+
+bool SqliteBackend::createSchema(QSqlDatabase &db)
+{
+    QSqlQuery query(db);
+    if (!execAll(query, {
+        "CREATE TABLE IF NOT EXISTS authors ("
+        "author_id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "name VARCHAR(255) NOT NULL)",
+
+        "CREATE TABLE IF NOT EXISTS genres ("
+        "genre_id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "name VARCHAR(255) NOT NULL)",
+
+        "CREATE TABLE IF NOT EXISTS publishers ("
+        "publisher_id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "name VARCHAR(255) NOT NULL)",
+
+        "CREATE TABLE IF NOT EXISTS readers ("
+        "reader_id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "name VARCHAR(255) NOT NULL, "
+        "email VARCHAR(255))",
+
+        "CREATE TABLE IF NOT EXISTS books ("
+        "book_id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "title VARCHAR(255) NOT NULL, "
+        "author_id INTEGER REFERENCES authors(author_id), "
+        "genre_id INTEGER REFERENCES genres(genre_id), "
+        "publisher_id INTEGER REFERENCES publishers(publisher_id), "
+        "publish_year INTEGER, "
+        "total_copies INTEGER DEFAULT 1)",
+
+        // Даты хранятся текстом в ISO 8601, поэтому сравниваются как строки
+        "CREATE TABLE IF NOT EXISTS issues ("
+        "issue_id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "book_id INTEGER REFERENCES books(book_id), "
+        "reader_id INTEGER REFERENCES readers(reader_id), "
+        "issue_date DATE NOT NULL DEFAULT CURRENT_DATE, "
+        "return_date DATE)",
+
+        "CREATE INDEX IF NOT EXISTS issues_issue_date_idx ON issues (issue_date)"
+    })) {
+        return false;
+    }
+
+    // Полнотекстовый индекс по названиям книг. Если SQLite собран без FTS5,
+    // поиск остаётся на LIKE
+    query.exec("SELECT 1 FROM sqlite_master WHERE name = 'books_fts'");
+    bool existed = query.next();
+    m_hasFts = execAll(query, {
+        "CREATE VIRTUAL TABLE IF NOT EXISTS books_fts USING fts5("
+        "title, content='books', content_rowid='book_id', tokenize='unicode61 remove_diacritics 2')",
+
+        "CREATE TRIGGER IF NOT EXISTS books_fts_ai AFTER INSERT ON books BEGIN "
+        "INSERT INTO books_fts (rowid, title) VALUES (new.book_id, new.title); END",
+
+        "CREATE TRIGGER IF NOT EXISTS books_fts_ad AFTER DELETE ON books BEGIN "
+        "INSERT INTO books_fts (books_fts, rowid, title) VALUES ('delete', old.book_id, old.title); END",
+
+        "CREATE TRIGGER IF NOT EXISTS books_fts_au AFTER UPDATE OF title ON books BEGIN "
+        "INSERT INTO books_fts (books_fts, rowid, title) VALUES ('delete', old.book_id, old.title); "
+        "INSERT INTO books_fts (rowid, title) VALUES (new.book_id, new.title); END"
+    });
+    if (m_hasFts && !existed) {
+        m_hasFts = query.exec("INSERT INTO books_fts (books_fts) VALUES ('rebuild')");
+    }
+    if (!m_hasFts) {
+        qDebug() << "FTS5 недоступен, поиск по книгам будет выполняться через LIKE";
+    }
+    return true;
+}
+
+QString SqliteBackend::searchFilter(const QString &table, const QStringList &columns, const QString &text) const
+{
+    const QStringList words = searchWords(text);
+    if (words.isEmpty() || columns.isEmpty()) {
+        return QString();
+    }
+
+    if (table == "books" && columns == QStringList{"title"} && m_hasFts) {
+        // Каждое слово ищется как префикс: "войн мир" найдёт "Война и мир".
+        // Слова состоят из букв и цифр, кавычки в них не встречаются
+        QStringList terms;
+        for (const QString &word : words) {
+            terms << "\"" + word + "\"*";
+        }
+        return "books.book_id IN (SELECT rowid FROM books_fts WHERE books_fts MATCH "
+               + quoted(terms.join(' ')) + ")";
+    }
+
+    // LIKE в SQLite не различает регистр только для латиницы, поэтому
+    // слова с другими буквами сервер не отбирает — их ищет клиент.
+    // Подстрока шире начала слова, лишние строки отсеет клиент
+    QStringList conditions;
+    for (const QString &word : words) {
+        bool ascii = true;
+        for (const QChar &ch : word) {
+            ascii = ascii && ch.unicode() < 0x80;
+        }
+        if (!ascii) continue;
+
+        QStringList alternatives;
+        for (const QString &column : columns) {
+            alternatives << column + " LIKE " + quoted("%" + word + "%");
+        }
+        conditions << "(" + alternatives.join(" OR ") + ")";
+    }
+    return conditions.join(" AND ");
+}
+
+QString SqliteBackend::dateLiteral(const QDate &date) const
+{
+    return quoted(date.toString(Qt::ISODate));
+}
+
+QStringList SqliteBackend::notificationChannels(const QStringList &) const
+{
+    // Подписка в QSQLITE ставит sqlite3_update_hook, который шлёт событие на
+    // каждую изменённую строку. Других пользователей у встроенной базы нет,
+    // а свои изменения окно перечитывает само, так что не подписываемся вовсе
+    return {};
+}
+
+QString SqliteBackend::changedTable(const QString &channel, const QVariant &) const
+{
+    return channel;
+}
+
+bool SqliteBackend::isExternalChange(QSqlDriver::NotificationSource) const
+{
+    // update_hook видит только изменения своего соединения, а других
+    // пользователей у встроенной базы нет
+    return false;
+}
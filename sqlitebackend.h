@@ -0,0 +1,42 @@
+#ifndef SQLITEBACKEND_H
+#define SQLITEBACKEND_H
+
+#include "sqlbackend.h"
+
+// Встроенная база в одном файле для однопользовательской установки
+class SqliteBackend : public SqlBackend
+{
+public:
+    SqliteBackend();
+
+    static QString databasePath();
+
+    QString name() const override { return "sqlite"; }
+    QString driverName() const override { return "QSQLITE"; }
+    bool isEmbedded() const override { return true; }
+
+    void configure(QSqlDatabase &db) const override;
+    bool initSession(QSqlDatabase &db) override;
+    bool createSchema(QSqlDatabase &db) override;
+
+    QString searchFilter(const QString &table, const QStringList &columns, const QString &text) const override;
+    QString dateLiteral(const QDate &date) const override;
+
+    // Клиентский курсор SQLite и так читает строки по одной
+    bool hasServerCursors() const override { return false; }
+    bool supportsReturning() const override { return false; }
+    // Предел SQLITE_MAX_VARIABLE_NUMBER у сборок старше 3.32
+    int maxBindValues() const override { return 999; }
+    // Появилось в SQLite 3.33; версия проверяется при открытии соединения
+    bool supportsUpdateFrom() const override { return m_hasUpdateFrom; }
+
+    QStringList notificationChannels(const QStringList &tables) const override;
+    QString changedTable(const QString &channel, const QVariant &payload) const override;
+    bool isExternalChange(QSqlDriver::NotificationSource source) const override;
+
+private:
+    bool m_hasFts;
+    bool m_hasUpdateFrom;
+};
+
+#endif // SQLITEBACKEND_H